@@ -8,565 +8,1314 @@
  * Description:
  * Algorithm to find some kinds of figures in bitmap image.
  */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "figsearch.h"
 
-#define HORIZONTAL_LINE 0
-#define VERTICAL_LINE 1
-#define EMPTY_LINE (Line){{-1, -1}, 0, -1}
-#define EMPTY_SQUARE (Square){{-1, -1}, {-1, -1}};
+#define RESULT_SIZE 160
+#define OPERATION_UNKNOWN (-1)
+#define OPERATION_TEST 0
+#define OPERATION_HLINE 1
+#define OPERATION_VLINE 2
+#define OPERATION_SQUARE 3
+#define OPERATION_ALL 4
+#define OPERATION_RECTANGLE 5
+#define OPERATION_FILLED_SQUARE 6
+#define OPERATION_FILLED_RECTANGLE 7
+#define OPERATION_DIAGONAL 8
+#define OPERATION_COUNT 9
+#define SERVE_BUFFER_SIZE (64 * 1024)
+#define DEFAULT_CACHE_MB 256
+#define PHASE_INDEX 0
+#define PHASE_TEST 1
+#define PHASE_PARSE 2
+#define PHASE_STREAM 3
+#define PHASE_SEARCH 4
+#define PHASE_COUNT 5
+#define STATS_NONE 0
+#define STATS_TEXT 1
+#define STATS_JSON 2
 
 /**
- * @brief Structure, describes Point object, contains 2 points.
+ * @brief Prints help message.
  */
-typedef struct {
-    int x_coordinate;
-    int y_coordinate;
-} Point;
+void show_help() {
+    printf("Usage: ./figsearch <operation> [...].\n");
+    printf("Image file \"-\" is read from stdin.\n");
+    printf("Operations: \n");
+    printf("  --help    Show help message.\n");
+    printf("  test      Checking the input file for correct bitmap image content.\n");
+    printf("  hline     Find the longest horizontal line in the image.\n");
+    printf("  vline     Find the longest vertical line in the image.\n");
+    printf("  square    Find the biggest square in the image.\n");
+    printf("  all       Find the longest lines and the biggest square in one pass.\n");
+    printf("  rectangle Find the biggest hollow rectangle(at least 2x2) by perimeter.\n");
+    printf("  filled-square\n");
+    printf("            Find the biggest square of 1 pixels.\n");
+    printf("  filled-rectangle\n");
+    printf("            Find the biggest rectangle of 1 pixels by area.\n");
+    printf("  diagonal  Find the longest 45 degree line, \"r1 c1 r2 c2\" from its top pixel.\n");
+    printf("  hlines, vlines, squares\n");
+    printf("            List all lines or squares as they are found, with --top the biggest ones first.\n");
+    printf("  convert <input> <output>\n");
+    printf("            Convert image to the binary bitmap format, all operations read both formats.\n");
+    printf("  index     Write run-length index next to the image, later queries are answered from it.\n");
+    printf("  batch <operation> [file...]\n");
+    printf("            Run operation on many files, file names are read from stdin if not given.\n");
+    printf("  serve <socket>\n");
+    printf("            Answer \"<operation> <file>\" request lines on the Unix socket, images are cached.\n");
+    printf("Options: \n");
+    printf("  --threads N  Search lines and squares on N threads(batch: N workers, default CPU count).\n");
+    printf("  --cache-mb N Memory budget of the serve image cache in MiB(default %d).\n", DEFAULT_CACHE_MB);
+    printf("  --max-memory N\n");
+    printf("               Search the file row by row in N MiB of memory, the bitmap is not stored.\n");
+    printf("  --stats      Print phase times and search counters to stderr(--stats=json as JSON).\n");
+    printf("  --top K      List only the K biggest figures(hlines, vlines, squares).\n");
+    printf("  --min N      List only figures of size at least N(hlines, vlines, squares).\n");
+    printf("  --limit N    List at most N figures(hlines, vlines, squares).\n");
+    printf("  --roi r0 c0 r1 c1\n");
+    printf("               Search only in the region, figures are cut by its borders.\n");
+    printf("               Rows below the region are not read, binary bitmap checksum is not checked.\n");
+    printf("Example: ./figsearch --help\n");
+}
 
 /**
- * @brief Structure, describes Line object, contains start point, line lenght, line type
+ * @brief Structure, describes command line options.
  */
 typedef struct {
-    Point start;
-    int length;
-    int line_type;
-} Line;
+    int threads;
+    long cache_mb;
+    long memory_mb;
+    int stats;
+    int top;
+    int min_size;
+    int limit;
+    int has_region;
+    Region region;
+} Options;
 
 /**
- * @brief Structure, describes square object, contains start and end Points objects.
+ * @brief Reads options from arguments and removes them, so the other arguments keep their positions.
+ *
+ * @param[in,out] argc Pointer to program argument count.
+ * @param[in,out] argv Program argument array.
+ * @param[out] options Pointer to options.
+ * @return 0 if options are correct.
+ * @return 1 if option is unknown or its value is not correct.
  */
-typedef struct {
-    Point start_point;
-    Point end_point;
-} Square;
+int parse_options(int *argc, char **argv, Options *options) {
+    options->threads = 0;
+    options->cache_mb = DEFAULT_CACHE_MB;
+    options->stats = STATS_NONE;
+    options->memory_mb = 0;
+    options->top = 0;
+    options->min_size = 1;
+    options->limit = 0;
+    options->has_region = 0;
+    int kept = 1;
+    for (int arg = 1; arg < *argc; arg++) {
+        if (strcmp(argv[arg], "--threads") == 0) {
+            char *end;
+            long threads = arg + 1 < *argc ? strtol(argv[arg + 1], &end, 10) : 0;
+            if (threads < 1 || threads > MAX_THREADS || *end != '\0') {
+                fprintf(stderr, "Invalid thread count\n");
+                return 1;
+            }
+            options->threads = (int)threads;
+            arg++;
+            continue;
+        }
+        if (strcmp(argv[arg], "--stats") == 0 || strcmp(argv[arg], "--stats=json") == 0) {
+            options->stats = argv[arg][7] == '=' ? STATS_JSON : STATS_TEXT;
+            continue;
+        }
+        if (strcmp(argv[arg], "--cache-mb") == 0 || strcmp(argv[arg], "--max-memory") == 0) {
+            char *end;
+            long size_mb = arg + 1 < *argc ? strtol(argv[arg + 1], &end, 10) : -1;
+            if (size_mb < 0 || size_mb > (long)(SIZE_MAX >> 20) || *end != '\0') {
+                fprintf(stderr, "Invalid memory size\n");
+                return 1;
+            }
+            *(argv[arg][2] == 'c' ? &options->cache_mb : &options->memory_mb) = size_mb;
+            arg++;
+            continue;
+        }
+        if (strcmp(argv[arg], "--top") == 0 || strcmp(argv[arg], "--min") == 0 || strcmp(argv[arg], "--limit") == 0) {
+            char *end;
+            long count = arg + 1 < *argc ? strtol(argv[arg + 1], &end, 10) : 0;
+            if (count < 1 || count > INT_MAX || *end != '\0') {
+                fprintf(stderr, "Invalid figure count\n");
+                return 1;
+            }
+            *(argv[arg][2] == 't' ? &options->top : argv[arg][2] == 'm' ? &options->min_size : &options->limit) = (int)count;
+            arg++;
+            continue;
+        }
+        if (strcmp(argv[arg], "--roi") == 0) {
+            int corners[4];
+            for (int corner = 0; corner < 4; corner++) { // r0 c0 r1 c1
+                char *end;
+                long value = arg + 1 < *argc ? strtol(argv[arg + 1], &end, 10) : -1;
+                if (value < 0 || value > INT_MAX || *end != '\0') {
+                    fprintf(stderr, "Invalid region\n");
+                    return 1;
+                }
+                corners[corner] = (int)value;
+                arg++;
+            }
+            options->region = (Region){{corners[0], corners[1]}, {corners[2], corners[3]}};
+            options->has_region = 1;
+            continue;
+        }
+        argv[kept++] = argv[arg];
+    }
+    *argc = kept;
+    argv[kept] = NULL;
+    return 0;
+}
 
 /**
- * @brief Structure, describes image object, contains width, height and bitmap data.
+ * @brief Converts operation name to the operation number.
+ *
+ * @param[in] name Operation name.
+ * @return operation number or OPERATION_UNKNOWN.
  */
-typedef struct {
-    int width;
-    int height;
-    int **bitmap;
-} Image;
+int operation_from_name(const char *name) {
+    if (strcmp(name, "test") == 0) {
+        return OPERATION_TEST;
+    }
+    if (strcmp(name, "hline") == 0) {
+        return OPERATION_HLINE;
+    }
+    if (strcmp(name, "vline") == 0) {
+        return OPERATION_VLINE;
+    }
+    if (strcmp(name, "square") == 0) {
+        return OPERATION_SQUARE;
+    }
+    if (strcmp(name, "all") == 0) {
+        return OPERATION_ALL;
+    }
+    if (strcmp(name, "rectangle") == 0) {
+        return OPERATION_RECTANGLE;
+    }
+    if (strcmp(name, "filled-square") == 0) {
+        return OPERATION_FILLED_SQUARE;
+    }
+    if (strcmp(name, "filled-rectangle") == 0) {
+        return OPERATION_FILLED_RECTANGLE;
+    }
+    if (strcmp(name, "diagonal") == 0) {
+        return OPERATION_DIAGONAL;
+    }
+    return OPERATION_UNKNOWN;
+}
 
 /**
- * @brief Testing file for correct bitmap content.
- *
- * Checks if the file contains the correct bitmap definition.
+ * @brief Writes line coordinates "r1 c1 r2 c2" or "Not found".
  *
- * @param[in] filename Filename to test content in.
- * @return 0 if file contains correct bitmap definition(test is passed).
- * @return 1 if file contains wrong bitmap defenition(test is not passed).
- */
-int test_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Error opening file %s\n", filename);
-        return 1;
+ * @param[in] line Line to write.
+ * @param[out] result Result text, at least RESULT_SIZE chars.
+ */
+void format_line(const Line *line, char *result) {
+    if (line->length == 0) { // If no longest line(no lines)
+        strcpy(result, "Not found");
+        return;
     }
+    int end_row = line->start.x_coordinate; // End point according to the line type
+    int end_col = line->start.y_coordinate + line->length - 1;
+    if (line->line_type == VERTICAL_LINE) {
+        end_row = line->start.x_coordinate + line->length - 1;
+        end_col = line->start.y_coordinate;
+    }
+    else if (line->line_type == DIAGONAL_LINE || line->line_type == ANTI_DIAGONAL_LINE) {
+        end_row = line->start.x_coordinate + line->length - 1;
+        end_col = line->line_type == DIAGONAL_LINE ? end_col : line->start.y_coordinate - line->length + 1;
+    }
+    snprintf(result, RESULT_SIZE, "%i %i %i %i", line->start.x_coordinate, line->start.y_coordinate, end_row, end_col);
+}
 
-    int rows;
-    int cols;
-    if (fscanf(file, "%d %d", &rows, &cols) != 2 || rows <= 0 || cols <= 0) {
-        return 1;
+/**
+ * @brief Writes square coordinates "r1 c1 r2 c2" or "Not found".
+ *
+ * @param[in] square Square to write.
+ * @param[in] perimeter Square perimeter, 0 if there is no square.
+ * @param[out] result Result text, at least RESULT_SIZE chars.
+ */
+void format_square(const Square *square, int perimeter, char *result) {
+    if (perimeter == 0) { // If no biggest square(no squares)
+        strcpy(result, "Not found");
+        return;
     }
+    snprintf(result, RESULT_SIZE, "%i %i %i %i", square->start_point.x_coordinate, square->start_point.y_coordinate,
+        square->end_point.x_coordinate, square->end_point.y_coordinate);
+}
 
-    int value;
-    int current_row = 0;
-    int current_col = 0;
-    while (fscanf(file, "%i", &value) != EOF) { //Reading till the end
-        if (value < 0 || value > 1) {
-            fclose(file);
-            return 1;
-        }
+/**
+ * @brief Writes result of the all operation, 3 lines: horizontal line, vertical line and square.
+ *
+ * @param[in] horizontal Longest horizontal line.
+ * @param[in] vertical Longest vertical line.
+ * @param[in] square Biggest square.
+ * @param[in] perimeter Square perimeter, 0 if there is no square.
+ * @param[out] result Result text, at least RESULT_SIZE chars.
+ */
+void format_all(const Line *horizontal, const Line *vertical, const Square *square, int perimeter, char *result) {
+    char texts[3][RESULT_SIZE];
+    format_line(horizontal, texts[0]);
+    format_line(vertical, texts[1]);
+    format_square(square, perimeter, texts[2]);
+    snprintf(result, RESULT_SIZE, "%.40s\n%.40s\n%.40s", texts[0], texts[1], texts[2]);
+}
 
-        current_col++;
-        if (current_col == cols) { //If line end, new line
-            current_col = 0;
-            current_row++;
-        }
+/**
+ * @brief Structure, describes wall time of the operation phases and search counters.
+ */
+typedef struct {
+    double phase_seconds[PHASE_COUNT];
+    SearchStats counters;
+} RunStats;
+
+static const char *const phase_names[PHASE_COUNT] = {"index", "test", "parse", "stream", "search"};
+
+/**
+ * @brief Moves found line from the region to the image coordinates.
+ */
+static void shift_line(Line *line, Point origin) {
+    if (line->length > 0) {
+        line->start.x_coordinate += origin.x_coordinate;
+        line->start.y_coordinate += origin.y_coordinate;
     }
-    fclose(file);
-    return !(current_row == rows && current_col == 0); // If last row and last col
 }
 
 /**
- * @brief Allocating space for store bitmap.
+ * @brief Moves found square from the region to the image coordinates.
+ */
+static void shift_square(Square *square, Point origin) {
+    square->start_point.x_coordinate += origin.x_coordinate;
+    square->start_point.y_coordinate += origin.y_coordinate;
+    square->end_point.x_coordinate += origin.x_coordinate;
+    square->end_point.y_coordinate += origin.y_coordinate;
+}
+
+/**
+ * @brief Runs operation on the stored image and writes its result text.
  *
- * @param[in] image Pointer to image to store bitmap content in.
- * @return 0 if allocation was successful(everything went well).
- * @return 1 if allocation was not successful(malloc error).
+ * @param[in] operation Operation number.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] context Search context.
+ * @param[in] origin Image position of the pixel(0, 0), not zero if image is a region.
+ * @param[out] result Result text, at least RESULT_SIZE chars.
+ * @return 0 if operation was successful(everything went well).
+ * @return 1 if error occurred while searching(result is "Invalid").
  */
-int allocate_bitmap(Image *image) {
-    int **allocated_array = malloc(image->height * sizeof(int *)); // 2-dimensional array(matrix) allocation
-    if (allocated_array == NULL) { // If allocated
-        return 1;
+int search_image(int operation, const Image *image, SearchContext *context, Point origin, char *result) {
+    strcpy(result, "Invalid");
+    if (operation == OPERATION_TEST) { // Image was stored, so it is valid
+        strcpy(result, "Valid");
     }
-    image->bitmap = allocated_array;
-
-    for (int allocated_row = 0; allocated_row < image->height; allocated_row++) { // Allocating space for each row
-        int *allocated = malloc(image->width * sizeof(int));
-        if (allocated == NULL) {
-            for (int was_allocated = 0; was_allocated < allocated_row; was_allocated++) { // Cleaning before allocated rows
-                image->bitmap[was_allocated] = NULL;
-                free(image->bitmap[was_allocated]);
-            }
-            free(allocated_array);
-            image->bitmap = NULL;
+    else if (operation == OPERATION_HLINE || operation == OPERATION_VLINE) {
+        int line_type = operation == OPERATION_HLINE ? HORIZONTAL_LINE : VERTICAL_LINE;
+        Line longest_line = EMPTY_LINE;
+        if (search_longest_line(context, image, &longest_line, line_type) == -1) { // If error while searching
+            return 1;
+        }
+        shift_line(&longest_line, origin);
+        format_line(&longest_line, result);
+    }
+    else if (operation == OPERATION_SQUARE) {
+        Square biggest_square = EMPTY_SQUARE;
+        int biggest_perimeter = search_biggest_square(context, image, &biggest_square);
+        if (biggest_perimeter == -1) { // If error while searching
+            return 1;
+        }
+        shift_square(&biggest_square, origin);
+        format_square(&biggest_square, biggest_perimeter, result);
+    }
+    else if (operation == OPERATION_ALL) {
+        Line horizontal;
+        Line vertical;
+        Square square;
+        int perimeter = search_all_figures(context, image, &horizontal, &vertical, &square);
+        if (perimeter == -1) {
+            return 1;
+        }
+        shift_line(&horizontal, origin);
+        shift_line(&vertical, origin);
+        shift_square(&square, origin);
+        format_all(&horizontal, &vertical, &square, perimeter, result);
+    }
+    else if (operation == OPERATION_RECTANGLE || operation == OPERATION_FILLED_RECTANGLE) {
+        Rectangle rectangle;
+        int size = operation == OPERATION_RECTANGLE ? search_biggest_rectangle(context, image, &rectangle)
+                                                    : search_biggest_filled_rectangle(context, image, &rectangle);
+        if (size == -1) {
+            return 1;
+        }
+        Square corners = {rectangle.start_point, rectangle.end_point};
+        shift_square(&corners, origin);
+        format_square(&corners, size, result);
+    }
+    else if (operation == OPERATION_FILLED_SQUARE) {
+        Square square;
+        int size = search_biggest_filled_square(context, image, &square);
+        if (size == -1) {
+            return 1;
+        }
+        shift_square(&square, origin);
+        format_square(&square, size, result);
+    }
+    else if (operation == OPERATION_DIAGONAL) {
+        Line diagonal;
+        if (search_longest_diagonal(context, image, &diagonal) == -1) {
             return 1;
         }
-        image->bitmap[allocated_row] = allocated; // Setting bitmap value to new allocated matrix
+        shift_line(&diagonal, origin);
+        format_line(&diagonal, result);
     }
     return 0;
 }
 
 /**
- * @brief Frees space where bitmap was stored.
- *
- * @param[in] image Pointer to image where bitmap stored is.
- * @return 0 if deallocation was successful(everything went well).
+ * @brief Returns monotonic time in seconds.
  */
-int free_bitmap(Image *image) {
-    if (image->bitmap == NULL) {
-        return 1;
+static double stats_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Adds time from the start to the phase and returns the current time.
+ */
+static double stats_phase_end(RunStats *stats, int phase, double start) {
+    double now = stats_time();
+    if (stats != NULL) {
+        stats->phase_seconds[phase] += now - start;
     }
-    for(int row = 0; row < image->height; row++) { // For each row in bitmap
-        free(image->bitmap[row]);
-        image->bitmap[row] = NULL;
+    return now;
+}
+
+/**
+ * @brief Adds count of the read bytes.
+ */
+static void stats_add_bytes(RunStats *stats, uint64_t bytes) {
+    if (stats != NULL) {
+        stats->counters.bytes_read += bytes;
     }
-    free(image->bitmap);
-    image->bitmap = NULL;
-    return 0;
 }
 
 /**
- * @brief Parses bitmap from file to image structure.
+ * @brief Adds size of the file to the read bytes, the whole file is read.
+ */
+static void stats_add_file(RunStats *stats, const char *filename) {
+    struct stat source;
+    if (stats != NULL && stat(filename, &source) == 0 && S_ISREG(source.st_mode)) {
+        stats->counters.bytes_read += (uint64_t)source.st_size;
+    }
+}
+
+/**
+ * @brief Runs operation on the image file and writes its result text.
+ *
+ * Result is "Valid", "Not found" or figure coordinates "r1 c1 r2 c2". Result of the all
+ * operation has 3 lines: horizontal line, vertical line and square.
  *
+ * @param[in] operation Operation number.
  * @param[in] filename Name of the image file.
- * @param[out] dst Pointer to image where will bitmap stored be.
- * @return 0 if parsing was successful(everything went well).
- * @return 1 if parsing occurred with an error(error while parsing).
+ * @param[in,out] image Pointer to image used as bitmap buffer, EMPTY_IMAGE or bitmap to reuse.
+ * @param[in] threads Count of threads for the search.
+ * @param[in] memory_limit Memory limit of the search in bytes, 0 if the bitmap can be stored.
+ * @param[in] region Pointer to region to search in, or NULL for the whole image.
+ * @param[out] result Result text, at least RESULT_SIZE chars.
+ * @param[in,out] stats Pointer to phase times and counters, or NULL.
+ * @return 0 if operation was successful(everything went well).
+ * @return 1 if file is not correct or error occurred(result is "Invalid").
  */
-int parse_image(Image *dst, const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        return 1;
+int run_operation(int operation, const char *filename, Image *image, int threads, size_t memory_limit, const Region *region,
+    char *result, RunStats *stats) {
+    strcpy(result, "Invalid");
+    SearchContext context = {NULL, threads, stats != NULL ? &stats->counters : NULL}; // Scratch memory is taken by malloc
+    double start = stats_time();
+    if (region != NULL) { // Only the region is read, figures are cut by its borders
+        Region clipped = *region;
+        uint64_t bytes_read = 0;
+        int status = parse_image_region(image, filename, &clipped, &bytes_read);
+        stats_add_bytes(stats, bytes_read); // Only the bytes till the region or of its rows are read
+        start = stats_phase_end(stats, PHASE_PARSE, start);
+        if (status) {
+            return 1;
+        }
+        status = search_image(operation, image, &context, clipped.start_point, result);
+        stats_phase_end(stats, PHASE_SEARCH, start);
+        return status;
     }
-    // Scanf must read 2 values, and they must be not 0
-    if (fscanf(file, "%d %d", &dst->height, &dst->width) != 2 || dst->height <= 0 || dst->width <= 0) {
-        fclose(file);
-        return 1;
+    Line indexed_lines[2];
+    Square indexed_square;
+    int indexed = operation != OPERATION_TEST && operation <= OPERATION_ALL; // Index holds only these figures
+    uint64_t index_bytes = 0; // Index header and the source hashed by the index key
+    int indexed_perimeter = indexed ? load_index(filename, &indexed_lines[0], &indexed_lines[1], &indexed_square, &index_bytes) : -1;
+    stats_add_bytes(stats, index_bytes);
+    start = stats_phase_end(stats, PHASE_INDEX, start);
+    if (indexed_perimeter != -1) { // Answers from the valid index
+        if (operation == OPERATION_HLINE || operation == OPERATION_VLINE) {
+            format_line(&indexed_lines[operation == OPERATION_HLINE ? 0 : 1], result);
+        }
+        else if (operation == OPERATION_SQUARE) {
+            format_square(&indexed_square, indexed_perimeter, result);
+        }
+        else {
+            format_all(&indexed_lines[0], &indexed_lines[1], &indexed_square, indexed_perimeter, result);
+        }
+        return 0;
     }
 
-    if (test_file(filename)) {
-        fclose(file);
+    stats_add_file(stats, filename);
+    if (operation == OPERATION_TEST) {
+        int status = test_file(filename);
+        stats_phase_end(stats, PHASE_TEST, start);
+        if (status) {
+            return 1;
+        }
+        strcpy(result, "Valid");
+        return 0;
+    }
+    if (memory_limit > 0 && operation > OPERATION_ALL) {
+        fprintf(stderr, "Operation can not be searched with the memory limit.\n");
         return 1;
     }
+    if ((operation == OPERATION_HLINE || operation == OPERATION_VLINE) && (threads <= 1 || memory_limit > 0)) {
+        Line longest_line = EMPTY_LINE; // Bitmap is not stored, line search keeps only the current row
+        int line_type = operation == OPERATION_HLINE ? HORIZONTAL_LINE : VERTICAL_LINE;
+        int line_length = search_longest_line_in_file(&context, filename, &longest_line, line_type);
+        stats_phase_end(stats, PHASE_STREAM, start);
+        if (line_length == -1) { // If file is not correct
+            return 1;
+        }
+        format_line(&longest_line, result);
+        return 0;
+    }
+    if (memory_limit > 0) { // Bitmap is not stored, file is searched row by row with bounded memory
+        Line lines[2];
+        Square square;
+        int perimeter = search_figures_in_file(&context, filename, memory_limit, &lines[0], &lines[1], &square);
+        stats_phase_end(stats, PHASE_STREAM, start);
+        if (perimeter == -2) {
+            fprintf(stderr, "Memory limit is too small for the image.\n");
+        }
+        if (perimeter < 0) {
+            return 1;
+        }
+        if (operation == OPERATION_SQUARE) {
+            format_square(&square, perimeter, result);
+        }
+        else {
+            format_all(&lines[0], &lines[1], &square, perimeter, result);
+        }
+        return 0;
+    }
 
-    if (allocate_bitmap(dst)) {
-        fclose(file);
+    size_t capacity = image->capacity;
+    int status = parse_image(image, filename);
+    start = stats_phase_end(stats, PHASE_PARSE, start);
+    if (stats != NULL && image->capacity != capacity) { // New bitmap block was allocated
+        stats->counters.allocations++;
+        stats->counters.allocated_bytes += image->capacity;
+    }
+    if (status) {
         return 1;
     }
+    status = search_image(operation, image, &context, (Point){0, 0}, result);
+    stats_phase_end(stats, PHASE_SEARCH, start);
+    return status;
+}
 
-    for (int row = 0; row < dst->height; row++) { // For each row
-        for(int col = 0; col < dst->width; col++) { // For each col in row
-            int value;
-            if (fscanf(file, "%d", &value) != 1) { // Reading data
-                free_bitmap(dst);
-                fclose(file);
-                return 1;
-            }
-            dst->bitmap[row][col] = value; // Setting value
-        }
+/**
+ * @brief Structure, describes deque of batch tasks(file indexes) owned by one worker.
+ *
+ * Owner takes tasks from the front, other workers steal them from the back.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int front;
+    int back;
+} TaskDeque;
+
+/**
+ * @brief Structure, describes batch of files processed by the worker pool.
+ */
+typedef struct {
+    int operation;
+    char **files;
+    char (*results)[RESULT_SIZE];
+    TaskDeque *deques;
+    int worker_count;
+    size_t memory_limit;
+} Batch;
+
+/**
+ * @brief Structure, describes one batch worker with its reused bitmap buffer.
+ */
+typedef struct {
+    Batch *batch;
+    int id;
+    Image image;
+} BatchWorker;
+
+/**
+ * @brief Takes task from the deque.
+ *
+ * @param[in] deque Pointer to deque.
+ * @param[in] steal 1 to take from the back(stealing), 0 to take from the front.
+ * @return file index or -1 if deque is empty.
+ */
+static int take_task(TaskDeque *deque, int steal) {
+    int task = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->front < deque->back) {
+        task = steal ? --deque->back : deque->front++;
     }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
 
-    fclose(file);
-    return 0;
+static void *batch_worker(void *argument) {
+    BatchWorker *worker = argument;
+    Batch *batch = worker->batch;
+    for (;;) {
+        int task = take_task(&batch->deques[worker->id], 0);
+        for (int victim = 1; task < 0 && victim < batch->worker_count; victim++) { // Own deque is empty, stealing
+            task = take_task(&batch->deques[(worker->id + victim) % batch->worker_count], 1);
+        }
+        if (task < 0) { // All deques are empty
+            return NULL;
+        }
+        run_operation(batch->operation, batch->files[task], &worker->image, 1, batch->memory_limit, NULL, batch->results[task], NULL);
+    }
 }
 
 /**
- * @brief Search all lines in image.
- *
- * @param[in] image Pointer to image where bitmap stored is.
- * @param[out] result Pointer to line array where line will stored be.
- * @param[in] result_size Pointer to integer value, where line array size stored is.
- * @param[in] lines_type Line type to find.
+ * @brief Reads list of files from stream, one file name per line.
  *
- * @return lines count If function executing was without error(everything went well).
- * @return -1 If error occurred while executing the function(error occurred).
- */
-int search_all_lines(const Image *image, Line **result, int *result_size, int lines_type) {
-    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) { // If image contains data
-        fprintf(stderr, "Image is empty.\n");
-        return -1;
-    }
-    int row_iterator = image->height;
-    int col_iterator = image->width;
-    if (lines_type == VERTICAL_LINE) { // Set the iteration method depending on line type
-        row_iterator = image->width;
-        col_iterator = image->height;
-    }
-
-    if (*result == NULL) { // Allocating space for the result array if it needed
-        *result_size = 1;
-        *result = malloc(sizeof(Line) * *result_size);
-        if (*result == NULL) {
-            return -1;
-        }
-    }
-
-    int lines_idx = 0;
-    for (int row = 0; row < row_iterator; row++) { // Iterating according to the setted iteration method
-        Line line = EMPTY_LINE;
-        int in_line = 0;
-        for (int col = 0; col < col_iterator; col++) {
-            int pos_color;
-            if (lines_type == VERTICAL_LINE)
-                pos_color = image->bitmap[col][row];
-            else
-                pos_color = image->bitmap[row][col];
-
-            if (pos_color) {
-                if (!in_line) { // Writing start pos to the line object
-                    if (lines_type == VERTICAL_LINE) {
-                        line.start.x_coordinate = col;
-                        line.start.y_coordinate = row;
-                    }
-                    else {
-                        line.start.x_coordinate = row;
-                        line.start.y_coordinate = col;
-                    }
-                    line.length = 1;
-                    in_line = 1;
-                    continue;
-                }
-                line.length++;
-                continue;
-            }
-            if (in_line) { // Writing the next line parts(size)
-                if (lines_idx >= *result_size) {
-                    int new_size = (*result_size) + 1;
-                    Line *lines_extend = realloc(*result, sizeof(Line) * new_size);
-                    if (lines_extend == NULL) {
-                        free(*result);
-                        return -1;
-                    }
-                    *result = lines_extend;
-                    *result_size = new_size;
-                }
-                (*result)[lines_idx++] = line;
-                in_line = 0;
-                line = EMPTY_LINE;
-            }
+ * @param[in] stream Stream to read.
+ * @param[out] count Pointer to count of read files.
+ * @return array of file names or NULL if allocation failed.
+ */
+char **read_manifest(FILE *stream, int *count) {
+    char **files = NULL;
+    int size = 0;
+    *count = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, stream)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) { // Removing line end
+            line[--length] = '\0';
         }
-        if (in_line) {
-            if (lines_idx >= *result_size) { // Writing the last part of the line
-                int new_size = (*result_size) + 1;
-                Line *lines_extend = realloc(*result, sizeof(Line) * new_size);
-                if (lines_extend == NULL) {
-                    free(*result);
-                    return -1;
-                }
-                *result = lines_extend;
-                *result_size = new_size;
+        if (length == 0) {
+            continue;
+        }
+        if (*count >= size) {
+            size = size ? size * 2 : 16;
+            char **files_extend = realloc(files, sizeof(char *) * (size_t)size);
+            if (files_extend == NULL) {
+                break;
             }
-            (*result)[lines_idx++] = line;
+            files = files_extend;
         }
+        files[*count] = strdup(line);
+        if (files[*count] == NULL) {
+            break;
+        }
+        (*count)++;
+    }
+    free(line);
+    if (files == NULL) {
+        files = malloc(sizeof(char *));
     }
-    return lines_idx;
+    return files;
 }
 
 /**
- * @brief Search all squares in image.
+ * @brief Runs operation on many files on the worker pool, prints "file: result" line for each file.
  *
- * @param[in] image Pointer to image where bitmap stored is.
- * @param[out] result Pointer to square array where square will stored be.
- * @param[in] result_size Pointer to integer value, where square array size stored is.
+ * Files are split to the workers in continuous parts, worker with no work steals from the others.
+ * Results are printed in the order of the files.
  *
- * @return squares count If function executing was without error(everything went well).
- * @return -1 If error occurred while executing the function(error occurred).
+ * @param[in] operation Operation number.
+ * @param[in] files File names.
+ * @param[in] file_count Count of files.
+ * @param[in] threads Count of worker threads.
+ * @param[in] memory_limit Memory limit of all workers in bytes(split evenly), 0 if bitmaps can be stored.
+ * @return 0 if all files were processed successfully.
+ * @return 1 if some file is not correct or error occurred.
  */
-int search_all_squares(const Image *image, Square **result, int *result_size) {
-    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) { // If image contains data
-        fprintf(stderr, "Image is empty.\n");
-        return -1;
+int run_batch(int operation, char **files, int file_count, int threads, size_t memory_limit) {
+    if (file_count == 0) {
+        return 0;
+    }
+    int worker_count = threads < file_count ? threads : file_count;
+    Batch batch = {operation, files, malloc(sizeof(*batch.results) * (size_t)file_count),
+        malloc(sizeof(TaskDeque) * (size_t)worker_count), worker_count, memory_limit / (size_t)worker_count};
+    BatchWorker *workers = malloc(sizeof(BatchWorker) * (size_t)worker_count);
+    pthread_t *thread_ids = malloc(sizeof(pthread_t) * (size_t)worker_count);
+    if (batch.results == NULL || batch.deques == NULL || workers == NULL || thread_ids == NULL) {
+        free(batch.results);
+        free(batch.deques);
+        free(workers);
+        free(thread_ids);
+        return 1;
     }
 
-    int rows = image->height;
-    int cols = image->width;
+    for (int worker = 0; worker < worker_count; worker++) {
+        pthread_mutex_init(&batch.deques[worker].lock, NULL);
+        batch.deques[worker].front = (int)((long long)file_count * worker / worker_count); // Files are split evenly
+        batch.deques[worker].back = (int)((long long)file_count * (worker + 1) / worker_count);
+        workers[worker] = (BatchWorker){&batch, worker, EMPTY_IMAGE};
+    }
+    int started = 1;
+    for (; started < worker_count; started++) { // Calling thread is the worker 0
+        if (pthread_create(&thread_ids[started], NULL, batch_worker, &workers[started]) != 0) {
+            break; // Not started worker tasks are stolen by the others
+        }
+    }
+    batch_worker(&workers[0]);
+    for (int worker = 1; worker < started; worker++) {
+        pthread_join(thread_ids[worker], NULL);
+    }
 
-    *result_size = 1;
-    *result = malloc(sizeof(Square) * (*result_size));
-    if (*result == NULL) { // Trying to allocate space for the result array
-        return -1;
+    int status = 0;
+    for (int file = 0; file < file_count; file++) {
+        for (char *line_end = strchr(batch.results[file], '\n'); line_end != NULL; line_end = strchr(line_end, '\n')) {
+            *line_end = ';'; // One line per file
+        }
+        printf("%s: %s\n", files[file], batch.results[file]);
+        if (strcmp(batch.results[file], "Invalid") == 0) {
+            status = 1;
+        }
     }
+    for (int worker = 0; worker < worker_count; worker++) {
+        free_bitmap(&workers[worker].image);
+        pthread_mutex_destroy(&batch.deques[worker].lock);
+    }
+    free(batch.results);
+    free(batch.deques);
+    free(workers);
+    free(thread_ids);
+    return status;
+}
 
-    int square_count = 0;
+/**
+ * @brief Structure, describes image stored in the server cache.
+ *
+ * Entry is valid while the file size and modification time are the same. Results of the
+ * operations are computed once for the entry. Entry removed from the cache while it is
+ * used(references > 0) is freed by the last release.
+ */
+typedef struct CacheEntry {
+    char *filename;
+    long long source_size;
+    long long source_mtime_sec;
+    long long source_mtime_nsec;
+    Image image;
+    int references;
+    int removed;
+    int result_ready[OPERATION_COUNT];
+    char results[OPERATION_COUNT][RESULT_SIZE];
+    struct CacheEntry *newer;
+    struct CacheEntry *older;
+} CacheEntry;
 
-    for (int start_row = 0; start_row < rows; start_row++) { // Iterating in the range of rows
-        for (int end_row = start_row + 1; end_row < rows; end_row++) {
-            int *add_row = malloc(sizeof(int) * rows); // Arrays for the row and col sum in the range
-            int *add_col = malloc(sizeof(int) * cols);
+/**
+ * @brief Structure, describes LRU cache of the images with memory budget.
+ *
+ * Entries are in the list from the most recently used one. Used is the size of the
+ * bitmaps in the cache, the least recently used entries are removed while it is over budget.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    CacheEntry *newest;
+    CacheEntry *oldest;
+    size_t used;
+    size_t budget;
+    int threads;
+} ImageCache;
 
-            if (add_row == NULL || add_col == NULL) { // Trying to allocate space for the result array
-                free(add_row);
-                free(add_col);
-                free(*result);
-                return -1;
-            }
+static void free_cache_entry(CacheEntry *entry) {
+    free_bitmap(&entry->image);
+    free(entry->filename);
+    free(entry);
+}
 
-            for (int col = 0; col < cols; col++) { // Iterating through the cols in the given row range
-                if (image->bitmap[start_row][col]) { // If square found
-                    if (square_count >= *result_size) { // If result array size must be resized
-                        *result_size += 1;
-                        Square *extended = realloc(*result, sizeof(Square) * (*result_size));
-                        if (extended == NULL) {
-                            free(*result);
-                            return -1;
-                        }
-                        *result = extended;
-                    }
-                    (*result)[square_count].start_point.x_coordinate = start_row; // Writing square info
-                    (*result)[square_count].start_point.y_coordinate = col;
-                    (*result)[square_count].end_point.x_coordinate = start_row;
-                    (*result)[square_count].end_point.y_coordinate = col;
-                    square_count++;
-                }
-                if (image->bitmap[end_row][col]) {// If square found
-                    if (square_count >= *result_size) { // If result array size must be resized
-                        *result_size += 1;
-                        Square *extended = realloc(*result, sizeof(Square) * (*result_size));
-                        if (extended == NULL) {
-                            free(*result);
-                            return -1;
-                        }
-                        *result = extended;
-                    }
-                    (*result)[square_count].start_point.x_coordinate = end_row; // Writing square info
-                    (*result)[square_count].start_point.y_coordinate = col;
-                    (*result)[square_count].end_point.x_coordinate = end_row;
-                    (*result)[square_count].end_point.y_coordinate = col;
-                    square_count++;
-                }
-                add_row[col] = image->bitmap[start_row][col] + image->bitmap[end_row][col];
-            }
-            for (int row = 0; row < rows; row++) { // Summ of each row in the range
-                add_col[row] = image->bitmap[row][start_row] + image->bitmap[row][end_row];
-            }
+/**
+ * @brief Removes entry from the cache list, entry is freed if it is not used. Cache must be locked.
+ */
+static void cache_remove(ImageCache *cache, CacheEntry *entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    }
+    else {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    }
+    else {
+        cache->oldest = entry->newer;
+    }
+    cache->used -= entry->image.capacity;
+    entry->removed = 1;
+    if (entry->references == 0) {
+        free_cache_entry(entry);
+    }
+}
 
-            int row_distance = end_row - start_row; // Distance between start and end rows
-            int row_sum = 0, col_sum = 0;
+/**
+ * @brief Puts entry to the front of the cache list. Cache must be locked.
+ */
+static void cache_push_newest(ImageCache *cache, CacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    }
+    cache->newest = entry;
+    if (cache->oldest == NULL) {
+        cache->oldest = entry;
+    }
+}
 
-            for (int row_in_range = 0; row_in_range <= row_distance; row_in_range++) { // For each row between start and end rows
-                row_sum += add_row[row_in_range];
-                col_sum += add_col[row_in_range];
+/**
+ * @brief Finds entry of the file with the same source size and modification time. Cache must be locked.
+ *
+ * Entry of the changed file is removed. Found entry is moved to the front and referenced.
+ */
+static CacheEntry *cache_find(ImageCache *cache, const char *filename, const struct stat *source) {
+    for (CacheEntry *entry = cache->newest; entry != NULL; entry = entry->older) {
+        if (strcmp(entry->filename, filename) != 0) {
+            continue;
+        }
+        if (entry->source_size != (long long)source->st_size || entry->source_mtime_sec != (long long)source->st_mtim.tv_sec ||
+            entry->source_mtime_nsec != (long long)source->st_mtim.tv_nsec) { // File was changed
+            cache_remove(cache, entry);
+            return NULL;
+        }
+        if (entry != cache->newest) { // Moving to the front
+            entry->newer->older = entry->older;
+            if (entry->older != NULL) {
+                entry->older->newer = entry->newer;
             }
+            else {
+                cache->oldest = entry->newer;
+            }
+            cache_push_newest(cache, entry);
+        }
+        entry->references++;
+        return entry;
+    }
+    return NULL;
+}
 
-            for (int start_col = 0; start_col <= cols - row_distance - 1; start_col++) { // Searching for the possible left side of the square
-                int end_col = start_col + row_distance;
-                if (row_sum == 2 * (row_distance + 1)) {
-                    if (square_count >= *result_size) {
-                        *result_size += 1;
-                        Square *extended = realloc(*result, sizeof(Square) * (*result_size));
-                        if (extended == NULL) { // Extend if needed
-                            free(add_row);
-                            free(add_col);
-                            free(*result);
-                            return -1;
-                        }
-                        *result = extended;
-                    }
-                    (*result)[square_count].start_point.x_coordinate = start_row; // Write the result
-                    (*result)[square_count].start_point.y_coordinate = start_col;
-                    (*result)[square_count].end_point.x_coordinate = end_row;
-                    (*result)[square_count].end_point.y_coordinate = end_col;
-                    square_count++;
-                }
+/**
+ * @brief Gets cached image of the file, file is parsed if it is not cached or it was changed.
+ *
+ * File is parsed without the cache lock, so other requests are not blocked. Returned entry
+ * must be released by cache_release.
+ *
+ * @param[in] cache Pointer to cache.
+ * @param[in] filename Name of the image file.
+ * @return entry or NULL if file is not correct or allocation failed.
+ */
+static CacheEntry *cache_acquire(ImageCache *cache, const char *filename) {
+    struct stat source;
+    if (stat(filename, &source) != 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = cache_find(cache, filename, &source);
+    pthread_mutex_unlock(&cache->lock);
+    if (entry != NULL) {
+        return entry;
+    }
 
-                row_sum = (end_col + 1 < cols) ? row_sum - add_row[start_col] + add_row[end_col + 1] : row_sum;
-                col_sum = (end_col + 1 < rows) ? col_sum - add_col[start_col] + add_col[end_col + 1] : col_sum;
-            }
+    entry = calloc(1, sizeof(CacheEntry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->image = EMPTY_IMAGE;
+    entry->filename = strdup(filename);
+    if (entry->filename == NULL || parse_image(&entry->image, filename)) {
+        free_cache_entry(entry);
+        return NULL;
+    }
+    entry->source_size = (long long)source.st_size;
+    entry->source_mtime_sec = (long long)source.st_mtim.tv_sec;
+    entry->source_mtime_nsec = (long long)source.st_mtim.tv_nsec;
+    entry->references = 1;
 
-            free(add_row);
-            free(add_col);
-        }
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *loaded = cache_find(cache, filename, &source); // Other request could load it meanwhile
+    if (loaded != NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        free_cache_entry(entry);
+        return loaded;
+    }
+    cache_push_newest(cache, entry);
+    cache->used += entry->image.capacity;
+    while (cache->used > cache->budget && cache->oldest != entry) { // Removing the least recently used
+        cache_remove(cache, cache->oldest);
     }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
 
-    return square_count;
+/**
+ * @brief Releases entry got by cache_acquire.
+ */
+static void cache_release(ImageCache *cache, CacheEntry *entry) {
+    pthread_mutex_lock(&cache->lock);
+    entry->references--;
+    if (entry->removed && entry->references == 0) {
+        free_cache_entry(entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
 }
 
 /**
- * @brief Searchs the longest line in image.
- *
- * @param[in] image Pointer to image where bitmap stored is.
- * @param[out] result Pointer to line where result line will stored be.
- * @param[in] line_type Line type to finding.
+ * @brief Answers one request line "<operation> <file>" with one result line.
  *
- * @return 0...n count of find lines(everything went well).
- * @return -1 if image definition is not correct (image error).
+ * @param[in] cache Pointer to cache.
+ * @param[in] request Request line without line end.
+ * @param[out] result Result text, at least RESULT_SIZE chars.
  */
-int search_longest_line(const Image *image, Line *result, int line_type) {
-    if (image->height < 0 || image->width < 0 || image->bitmap == NULL) // Checking the image for rhe correct bitmap
-        return -1;
+static void serve_request(ImageCache *cache, char *request, char *result) {
+    char *filename = strchr(request, ' ');
+    if (filename == NULL) {
+        strcpy(result, "Invalid request");
+        return;
+    }
+    *filename++ = '\0';
+    int operation = operation_from_name(request);
+    if (operation == OPERATION_UNKNOWN || *filename == '\0') {
+        strcpy(result, "Invalid request");
+        return;
+    }
 
-    Line *lines = NULL;
-    int size = 0;
-    int found_count = search_all_lines(image, &lines, &size, line_type); // Searching for all lines
-    if (found_count <= 0) {
-        return 0;
+    CacheEntry *entry = cache_acquire(cache, filename);
+    if (entry == NULL) {
+        strcpy(result, "Invalid");
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    int ready = entry->result_ready[operation];
+    if (ready) {
+        strcpy(result, entry->results[operation]);
     }
-    Line longest_line = EMPTY_LINE;
-    for (int line = 0; line < found_count; line++) { // Comparing each line with the biggest
-        if (lines[line].length > longest_line.length) {
-            longest_line = lines[line];
+    pthread_mutex_unlock(&cache->lock);
+    if (!ready) { // Image is only read, so the same entry can be searched by more requests
+        SearchContext context = {NULL, cache->threads, NULL};
+        if (search_image(operation, &entry->image, &context, (Point){0, 0}, result) == 0) {
+            pthread_mutex_lock(&cache->lock);
+            strcpy(entry->results[operation], result);
+            entry->result_ready[operation] = 1;
+            pthread_mutex_unlock(&cache->lock);
         }
     }
-    if (longest_line.length == 1 && line_type == VERTICAL_LINE) { // Searching each 1 lenght vertical line
-        return search_longest_line(image, result, HORIZONTAL_LINE);
+    cache_release(cache, entry);
+
+    for (char *line_end = strchr(result, '\n'); line_end != NULL; line_end = strchr(line_end, '\n')) {
+        *line_end = ';'; // One line per request
     }
-    free(lines);
-    lines = NULL;
-    *result = longest_line;
-    return longest_line.length;
 }
 
 /**
- * @brief Checks is square empty
+ * @brief Structure, describes one client connection of the server.
+ */
+typedef struct {
+    ImageCache *cache;
+    int socket;
+} ServeConnection;
+
+/**
+ * @brief Writes all bytes to the socket.
  *
- * @param square
- * @return 1 If square is empty
- * @return 0 If square is not empty
+ * @return 0 if all bytes were written, 1 if connection was closed.
  */
-int is_empty(Square *square) {
-    Square empty_square = EMPTY_SQUARE;
-    return  square->start_point.x_coordinate == empty_square.start_point.x_coordinate && // Checking is square empty, by comparing square parameter
-        square->end_point.x_coordinate == empty_square.end_point.x_coordinate &&
-            square->start_point.y_coordinate == empty_square.start_point.y_coordinate &&
-                square->end_point.y_coordinate == empty_square.end_point.y_coordinate;
+static int send_all(int socket, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return 1;
+        }
+        data += sent;
+        size -= (size_t)sent;
+    }
+    return 0;
 }
 
 /**
- * @brief Searchs biggest square in squares array.
+ * @brief Answers requests of one connection in their order.
  *
- * @param image
- * @param result
- * @return perimeter of the biggest square.
- * @return -1 if exectuion was not successful
+ * Requests can be pipelined, all complete requests of one read are answered and their
+ * results are sent together.
  */
-int search_biggest_square(const Image *image, Square *result) {
-    if (image->height < 0 || image->width < 0 || image->bitmap == NULL)
-        return -1;
-    Square *squares = NULL;
+static void *serve_connection(void *argument) {
+    ServeConnection *connection = argument;
+    char *requests = malloc(SERVE_BUFFER_SIZE);
+    char *responses = malloc(SERVE_BUFFER_SIZE);
+    size_t pending = 0;
+    for (;;) {
+        if (requests == NULL || responses == NULL || pending == SERVE_BUFFER_SIZE) { // Request is too long
+            break;
+        }
+        ssize_t received = recv(connection->socket, requests + pending, SERVE_BUFFER_SIZE - pending, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        pending += (size_t)received;
 
-    int size = 0;
-    int squares_count = search_all_squares(image, &squares, &size);
-    if (squares_count == -1) {
-        return -1; // If error
+        size_t response_size = 0;
+        char *request = requests;
+        char *line_end;
+        while ((line_end = memchr(request, '\n', pending - (size_t)(request - requests))) != NULL) {
+            *line_end = '\0';
+            if (line_end > request && line_end[-1] == '\r') {
+                line_end[-1] = '\0';
+            }
+            if (response_size + RESULT_SIZE + 1 > SERVE_BUFFER_SIZE) { // Sending full response buffer
+                if (send_all(connection->socket, responses, response_size)) {
+                    pending = 0;
+                    break;
+                }
+                response_size = 0;
+            }
+            serve_request(connection->cache, request, responses + response_size);
+            response_size += strlen(responses + response_size);
+            responses[response_size++] = '\n';
+            request = line_end + 1;
+        }
+        if (pending == 0 || send_all(connection->socket, responses, response_size)) {
+            break;
+        }
+        pending -= (size_t)(request - requests);
+        memmove(requests, request, pending); // Keeping the incomplete request
     }
+    free(requests);
+    free(responses);
+    close(connection->socket);
+    free(connection);
+    return NULL;
+}
 
-    Square biggest_square = EMPTY_SQUARE;
-    for (int square_idx = 0; square_idx < squares_count; square_idx++) { // Searching the biggest square by comparing each perimiter
-        int square_idx_perimeter = (squares[square_idx].end_point.x_coordinate - squares[square_idx].start_point.x_coordinate + 1) * 4;
-        int biggest_perimeter = (biggest_square.end_point.x_coordinate - biggest_square.start_point.x_coordinate + 1) * 4;
-        if (square_idx_perimeter > biggest_perimeter || is_empty(&biggest_square)) { // If current is biggest or empty
-            biggest_square = squares[square_idx];
+/**
+ * @brief Answers requests on the Unix domain socket until the process is stopped.
+ *
+ * Each connection is served by its own thread. Request is one line "<operation> <file>",
+ * result is one line(lines of the all result are separated by ';').
+ *
+ * @param[in] path Socket path, existing socket file is replaced.
+ * @param[in] cache_budget Memory budget of the image cache in bytes.
+ * @param[in] threads Count of threads for one search.
+ * @return 1 if socket can not be created.
+ */
+int run_server(const char *path, size_t cache_budget, int threads) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path is too long\n");
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        perror(path);
+        close(listener);
+        return 1;
+    }
+
+    ImageCache cache = {.budget = cache_budget, .threads = threads};
+    pthread_mutex_init(&cache.lock, NULL);
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        ServeConnection *connection = malloc(sizeof(ServeConnection));
+        pthread_t thread;
+        if (connection == NULL) {
+            close(client);
+            continue;
+        }
+        *connection = (ServeConnection){&cache, client};
+        if (pthread_create(&thread, &attributes, serve_connection, connection) != 0) {
+            free(connection);
+            close(client);
         }
     }
-    free(squares);
-    *result = biggest_square;
-    return (biggest_square.end_point.x_coordinate - biggest_square.start_point.x_coordinate + 1) * 4; // Returning perimeter if the biggest square
+    pthread_attr_destroy(&attributes);
+    close(listener);
+    return 1;
 }
 
 /**
- * @brief Prints help message.
+ * @brief Prints phase times and counters to stderr.
+ *
+ * @param[in] stats Pointer to phase times and counters.
+ * @param[in] total Wall time of the whole operation.
+ * @param[in] format STATS_TEXT or STATS_JSON.
  */
-void show_help() {
-    printf("Usage: ./figsearch <operation> [...].\n");
-    printf("Operations: \n");
-    printf("  --help    Show help message.\n");
-    printf("  test      Checking the input file for correct bitmap image content.\n");
-    printf("  hline     Find the longest horizontal line in the image.\n");
-    printf("  vline     Find the longest vertical line in the image.\n");
-    printf("  square    Find the biggest square in the image.\n");
-    printf("Example: ./figsearch --help\n");
+void print_stats(const RunStats *stats, double total, int format) {
+    struct rusage usage;
+    long peak_rss_kib = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0; // Linux reports KiB
+    const SearchStats *counters = &stats->counters;
+    if (format == STATS_JSON) {
+        fprintf(stderr, "{\"total_seconds\": %.9f, \"phases\": {", total);
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            fprintf(stderr, "%s\"%s\": %.9f", phase ? ", " : "", phase_names[phase], stats->phase_seconds[phase]);
+        }
+        fprintf(stderr, "}, \"bytes_read\": %llu, \"pixels\": %llu, \"segments\": %llu, \"candidate_squares\": %llu, "
+            "\"allocations\": %llu, \"allocated_bytes\": %llu, \"peak_rss_kib\": %ld}\n", (unsigned long long)counters->bytes_read,
+            (unsigned long long)counters->pixels, (unsigned long long)counters->segments,
+            (unsigned long long)counters->candidate_squares, (unsigned long long)counters->allocations,
+            (unsigned long long)counters->allocated_bytes, peak_rss_kib);
+        return;
+    }
+    fprintf(stderr, "total             %.6f s\n", total);
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (stats->phase_seconds[phase] > 0) {
+            fprintf(stderr, "%-17s %.6f s\n", phase_names[phase], stats->phase_seconds[phase]);
+        }
+    }
+    fprintf(stderr, "bytes read        %llu\n", (unsigned long long)counters->bytes_read);
+    fprintf(stderr, "pixels            %llu\n", (unsigned long long)counters->pixels);
+    fprintf(stderr, "segments          %llu\n", (unsigned long long)counters->segments);
+    fprintf(stderr, "candidate squares %llu\n", (unsigned long long)counters->candidate_squares);
+    fprintf(stderr, "allocations       %llu(%llu bytes)\n", (unsigned long long)counters->allocations,
+        (unsigned long long)counters->allocated_bytes);
+    fprintf(stderr, "peak RSS          %ld KiB\n", peak_rss_kib);
+}
+
+/**
+ * @brief Structure, describes listing of the found figures.
+ */
+typedef struct {
+    int min_size;
+    int limit;
+    int count;
+    Point origin;
+} FigureList;
+
+/**
+ * @brief Prints figure coordinates line "r1 c1 r2 c2".
+ *
+ * @return 1 if the limit of the list is reached, so the search stops.
+ */
+static int list_square(void *context, Square square, int size) {
+    FigureList *list = context;
+    (void)size;
+    shift_square(&square, list->origin);
+    printf("%i %i %i %i\n", square.start_point.x_coordinate, square.start_point.y_coordinate, square.end_point.x_coordinate,
+        square.end_point.y_coordinate);
+    list->count++;
+    return list->limit > 0 && list->count >= list->limit;
+}
+
+static int list_line(void *context, Line line) {
+    FigureList *list = context;
+    if (line.length < list->min_size) {
+        return 0;
+    }
+    char text[RESULT_SIZE];
+    shift_line(&line, list->origin);
+    format_line(&line, text);
+    printf("%s\n", text);
+    list->count++;
+    return list->limit > 0 && list->count >= list->limit;
+}
+
+/**
+ * @brief Lists figures of the hlines, vlines or squares command.
+ *
+ * Without --top figures are printed as they are found. With --top only K figures are
+ * kept, they are printed biggest first when the search ends.
+ *
+ * @param[in] command Command name.
+ * @param[in] filename Name of the image file.
+ * @param[in] options Pointer to options.
+ * @return 0 if figures were listed.
+ * @return 1 if file is not correct or error occurred.
+ */
+int list_figures(const char *command, const char *filename, const Options *options) {
+    Image image = EMPTY_IMAGE;
+    Region region = options->region;
+    if (options->has_region ? parse_image_region(&image, filename, &region, NULL) : parse_image(&image, filename)) {
+        fprintf(stderr, "%s", "Invalid");
+        return 1;
+    }
+    SearchContext context = {NULL, 1, NULL};
+    int is_square = strcmp(command, "squares") == 0;
+    int line_type = strcmp(command, "hlines") == 0 ? HORIZONTAL_LINE : VERTICAL_LINE;
+    FigureList list = {options->min_size, options->limit, 0, options->has_region ? region.start_point : (Point){0, 0}};
+    int status = 0;
+    if (options->top == 0) {
+        status = is_square ? search_all_squares(&context, &image, options->min_size, list_square, &list)
+                           : search_all_lines(&image, line_type, list_line, &list);
+    }
+    else {
+        size_t figure_size = is_square ? sizeof(Square) : sizeof(Line);
+        void *figures = malloc(figure_size * (size_t)options->top); // Only K figures are kept
+        int found = -1;
+        if (figures != NULL) {
+            found = is_square ? search_top_squares(&context, &image, options->top, options->min_size, figures)
+                              : search_top_lines(&image, line_type, options->top, options->min_size, figures);
+        }
+        for (int figure = 0; figure < found; figure++) { // Limit stops the listing
+            if (is_square ? list_square(&list, ((Square *)figures)[figure], 0) : list_line(&list, ((Line *)figures)[figure])) {
+                break;
+            }
+        }
+        status = found == -1 ? -1 : 0;
+        free(figures);
+    }
+    free_bitmap(&image);
+    if (status == -1) {
+        fprintf(stderr, "%s", "Invalid");
+        return 1;
+    }
+    if (list.count == 0) {
+        printf("Not found");
+    }
+    return 0;
 }
 
 /**
  *
  * @param command command to execute
  * @param arguments arguments to the given command
+ * @param options command line options
  * @return 0 if command execution was ok
  * @return 1 if command execution was with error
  */
-int command_handler(char *command, char **arguments) {
-    if (strcmp(command, "test") == 0) {
-        if (test_file(arguments[2])) {
+int command_handler(char *command, char **arguments, const Options *options) {
+    if (strcmp(command, "index") == 0) {
+        if (build_index(arguments[2])) {
             fprintf(stderr,"%s", "Invalid");
             return 1;
         }
-        printf("%s", "Valid");
+        return 0;
     }
-    else if (strstr(command, "line")) { // Handling all *line commands
-        if (strcmp(command, "hline") != 0 && strcmp(command, "vline") != 0) { // If only hline or vline
-            return 0;
-        }
-
-        int line_type = VERTICAL_LINE;
-        if (strcmp(command, "hline") == 0) { // Setting line type by the picked method
-            line_type = HORIZONTAL_LINE;
-        }
-
-        Image image;
-
+    if (strcmp(command, "convert") == 0) {
+        Image image = EMPTY_IMAGE;
         if (parse_image(&image, arguments[2])) {
             fprintf(stderr,"%s", "Invalid");
-            return -1;
+            return 1;
         }
-
-        Line longest_line = EMPTY_LINE;
-        int hline_len = search_longest_line(&image, &longest_line, line_type);
+        int status = write_binary_bitmap(&image, arguments[3]);
         free_bitmap(&image);
-
-        if (hline_len == -1) {
-            fprintf(stderr,"%s", "Invalid"); // If error while searching
-            return -1;
-        }
-        if (longest_line.length == 0) { // If no longest line(no lines)
-            printf("%s", "Not found");
-            return 0;
+        if (status) {
+            fprintf(stderr, "Error writing file %s\n", arguments[3]);
+            return 1;
         }
-        if (line_type == HORIZONTAL_LINE) { // Printing line according to the line type
-            printf("%i %i %i %i", longest_line.start.x_coordinate, longest_line.start.y_coordinate,
-                longest_line.start.x_coordinate, longest_line.start.y_coordinate+longest_line.length-1);
+        return 0;
+    }
+    if (strcmp(command, "serve") == 0) {
+        return run_server(arguments[2], (size_t)options->cache_mb << 20, options->threads);
+    }
+    if (strcmp(command, "batch") == 0) {
+        int operation = operation_from_name(arguments[2]);
+        if (operation == OPERATION_UNKNOWN) {
+            show_help();
+            return 1;
         }
-        else {
-            printf("%i %i %i %i", longest_line.start.x_coordinate, longest_line.start.y_coordinate,
-                longest_line.start.x_coordinate+longest_line.length-1, longest_line.start.y_coordinate);
+        int threads = options->threads;
+        size_t memory_limit = (size_t)options->memory_mb << 20;
+        if (threads < 1) { // Default is one worker per CPU
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : (int)cpus;
         }
-    }
-    else if (strcmp(command, "square") == 0) {
-        Image image;
-        if (parse_image(&image, arguments[2])) {
-            fprintf(stderr,"%s", "Invalid");
-            return -1;
+        if (arguments[3] != NULL && strcmp(arguments[3], "-") != 0) { // Files from the arguments
+            int file_count = 0;
+            while (arguments[3 + file_count] != NULL) {
+                file_count++;
+            }
+            return run_batch(operation, arguments + 3, file_count, threads, memory_limit);
         }
 
-        Square biggest_square = EMPTY_SQUARE;
-        int biggest_perimeter = search_biggest_square(&image, &biggest_square);
+        int file_count;
+        char **files = read_manifest(stdin, &file_count); // Files from the stdin manifest
+        if (files == NULL) {
+            return 1;
+        }
+        int status = run_batch(operation, files, file_count, threads, memory_limit);
+        for (int file = 0; file < file_count; file++) {
+            free(files[file]);
+        }
+        free(files);
+        return status;
+    }
 
-        free_bitmap(&image);
+    if (strcmp(command, "hlines") == 0 || strcmp(command, "vlines") == 0 || strcmp(command, "squares") == 0) {
+        return list_figures(command, arguments[2], options);
+    }
 
-        if (biggest_perimeter <= 0) {
-            printf("%s", "Not found"); // If no biggest square(no squares)
-            return 0;
+    int operation = operation_from_name(command);
+    if (operation == OPERATION_UNKNOWN) {
+        if (!strstr(command, "line")) { // Other *line commands do nothing
+            show_help();
         }
-        printf("%i %i %i %i\n", biggest_square.start_point.x_coordinate, biggest_square.start_point.y_coordinate,
-            biggest_square.end_point.x_coordinate, biggest_square.end_point.y_coordinate);
+        return 0;
     }
-    else {
-        show_help();
+
+    Image image = EMPTY_IMAGE;
+    char result[RESULT_SIZE];
+    RunStats stats = {{0}, {0}};
+    double start = stats_time();
+    int status = run_operation(operation, arguments[2], &image, options->threads, (size_t)options->memory_mb << 20,
+        options->has_region ? &options->region : NULL, result,
+        options->stats ? &stats : NULL);
+    free_bitmap(&image);
+    if (options->stats) {
+        print_stats(&stats, stats_time() - start, options->stats);
+    }
+    if (status) {
+        fprintf(stderr,"%s", result);
+        return 1;
+    }
+    printf("%s", result);
+    int is_area = operation == OPERATION_SQUARE || operation == OPERATION_RECTANGLE || operation == OPERATION_FILLED_SQUARE ||
+        operation == OPERATION_FILLED_RECTANGLE;
+    if ((is_area && strcmp(result, "Not found") != 0) || operation == OPERATION_ALL) {
+        printf("\n");
     }
     return 0;
 }
@@ -580,12 +1329,24 @@ int command_handler(char *command, char **arguments) {
  * @return 1 if command execution was with error
  */
 int main(int argc, char *argv[]) {
+    Options options;
+    if (parse_options(&argc, argv, &options)) {
+        show_help();
+        return 1;
+    }
+
     char *command = "help";
     if (argc >= 2) {
         command = argv[1];
     }
 
-    if (strstr(command, "line") || strcmp(command, "square") == 0 || strcmp(command, "test") == 0) {
+    if (strcmp(command, "convert") == 0 && argc < 4) {
+        fprintf(stderr, "%s", "Invalid argument count\n");
+        show_help();
+        return 1;
+    }
+    if (strstr(command, "line") || operation_from_name(command) != OPERATION_UNKNOWN || strcmp(command, "squares") == 0 ||
+        strcmp(command, "batch") == 0 || strcmp(command, "index") == 0 || strcmp(command, "serve") == 0) {
         if (argc < 3) {
             fprintf(stderr, "%s", "Invalid argument count\n");
             show_help();
@@ -593,7 +1354,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (command_handler(command, argv)) {
+    if (command_handler(command, argv, &options)) {
         return 1;
     }
     return 0;
@@ -0,0 +1,267 @@
+/**
+ * @author Behari Youssef
+ * @name Figsearch
+ * @date 29 November 2024
+ * @file figsearch.h
+ * @version 1.0
+ *
+ * Description:
+ * Library to find some kinds of figures in bitmap image.
+ */
+#ifndef FIGSEARCH_H
+#define FIGSEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HORIZONTAL_LINE 0
+#define VERTICAL_LINE 1
+#define DIAGONAL_LINE 2
+#define ANTI_DIAGONAL_LINE 3
+#define EMPTY_LINE (Line){{-1, -1}, 0, -1}
+#define EMPTY_SQUARE (Square){{-1, -1}, {-1, -1}};
+#define EMPTY_IMAGE (Image){0, 0, 0, NULL, 0}
+#define BITMAP_WORD_BITS 64
+#define BITMAP_ALIGNMENT 64
+#define MAX_THREADS 1024
+
+/**
+ * @brief Storage word of the bit-packed bitmap, one bit per pixel.
+ */
+typedef uint64_t BitmapWord;
+
+/**
+ * @brief Structure, describes Point object, contains 2 points.
+ */
+typedef struct {
+    int x_coordinate;
+    int y_coordinate;
+} Point;
+
+/**
+ * @brief Structure, describes Line object, contains start point, line lenght, line type
+ */
+typedef struct {
+    Point start;
+    int length;
+    int line_type;
+} Line;
+
+/**
+ * @brief Structure, describes square object, contains start and end Points objects.
+ */
+typedef struct {
+    Point start_point;
+    Point end_point;
+} Square;
+
+/**
+ * @brief Structure, describes rectangle object, contains top-left and bottom-right points.
+ */
+typedef struct {
+    Point start_point;
+    Point end_point;
+} Rectangle;
+
+/**
+ * @brief Structure, describes rectangular region of the image, both corners are included.
+ */
+typedef struct {
+    Point start_point;
+    Point end_point;
+} Region;
+
+/**
+ * @brief Structure, describes image object, contains width, height and bitmap data.
+ *
+ * Bitmap is stored bit-packed in one contiguous cache-line aligned block. Each row
+ * takes stride words, pixel (row, col) is bit (col % 64) of word row * stride + col / 64.
+ * Padding bits after the last col of the row are always 0. Capacity is the size of
+ * the allocated block in bytes, block can be reused for the next image.
+ */
+typedef struct {
+    int width;
+    int height;
+    size_t stride;
+    BitmapWord *bitmap;
+    size_t capacity;
+} Image;
+
+/**
+ * @brief Returns pointer to the first word of the bitmap row.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] row Row index.
+ * @return Pointer to the row words.
+ */
+static inline BitmapWord *bitmap_row(const Image *image, int row) {
+    return image->bitmap + (size_t)row * image->stride;
+}
+
+/**
+ * @brief Reads one pixel from the bitmap.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] row Row index.
+ * @param[in] col Col index.
+ * @return 1 if pixel is set, 0 otherwise.
+ */
+static inline int get_pixel(const Image *image, int row, int col) {
+    return (int)((bitmap_row(image, row)[col / BITMAP_WORD_BITS] >> (col % BITMAP_WORD_BITS)) & 1u);
+}
+
+/**
+ * @brief Writes one pixel to the bitmap.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] row Row index.
+ * @param[in] col Col index.
+ * @param[in] value New pixel value(0 or 1).
+ */
+static inline void set_pixel(Image *image, int row, int col, int value) {
+    BitmapWord mask = (BitmapWord)1 << (col % BITMAP_WORD_BITS);
+    BitmapWord *word = &bitmap_row(image, row)[col / BITMAP_WORD_BITS];
+    if (value) {
+        *word |= mask;
+    }
+    else {
+        *word &= ~mask;
+    }
+}
+
+/**
+ * @brief Structure, describes consumer of the parsed rows.
+ *
+ * begin is called once after the header, row is called for each packed row as soon
+ * as it is read. Row words are valid only during the call.
+ */
+typedef struct {
+    int (*begin)(void *context, int rows, int cols);
+    int (*row)(void *context, int row, const BitmapWord *words);
+    void *context;
+} RowSink;
+
+/**
+ * @brief Callback, receives each found line.
+ *
+ * @return 0 to continue searching, other value stops the search with this value.
+ */
+typedef int (*LineHandler)(void *context, Line line);
+
+/**
+ * @brief Callback, receives each found square and its size.
+ *
+ * @return 0 to continue searching, other value stops the search with this value.
+ */
+typedef int (*SquareHandler)(void *context, Square square, int size);
+
+/**
+ * @brief Structure, describes bump allocator on the caller owned memory block.
+ *
+ * Blocks are aligned to BITMAP_ALIGNMENT. Arena never calls malloc, it only gives
+ * parts of the memory block, all of them are freed at once by arena_reset.
+ */
+typedef struct {
+    unsigned char *memory;
+    size_t capacity;
+    size_t used;
+} Arena;
+
+/**
+ * @brief Structure, describes counters of the searchs.
+ *
+ * Searchs add to the counters: pixels of the searched images, line segments passed to the
+ * line search, candidate squares checked by the square search and scratch allocations.
+ * bytes_read is not filled by the searchs, it is left to the caller.
+ */
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t pixels;
+    uint64_t segments;
+    uint64_t candidate_squares;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+} SearchStats;
+
+/**
+ * @brief Structure, describes context of the search calls.
+ *
+ * If arena is not NULL, all scratch memory of the search is taken from it, search returns
+ * -1 if it is full. Otherwise malloc is used. Threads is the count of threads of the
+ * search(less than 2 means the calling thread only). If stats is not NULL, counters are
+ * added to it. NULL context is 1 thread and malloc. Context can be used by one call at a time.
+ */
+typedef struct {
+    Arena *arena;
+    int threads;
+    SearchStats *stats;
+} SearchContext;
+
+/**
+ * @brief Structure, describes tree of lines, each node holds the first line of its leaves.
+ *
+ * Leaves are in nodes[leaf_count...2 * leaf_count - 1], root is nodes[1].
+ */
+typedef struct {
+    int leaf_count;
+    Line *nodes;
+} LineTree;
+
+/**
+ * @brief Structure, describes search which is updated after the pixel changes.
+ *
+ * Image is the own copy of the searched image. Down-run and right-run tables hold count
+ * of 1 pixels from each pixel downwards and to the right(width ints per row). Trees hold
+ * the longest horizontal line and the first 1 pixel of each row, the longest vertical line
+ * of each col and the biggest square with the top-left corner on each row(as line of the
+ * square size).
+ */
+typedef struct {
+    Image image;
+    int *down_run;
+    int *right_run;
+    LineTree horizontal;
+    LineTree vertical;
+    LineTree first_pixel;
+    LineTree squares;
+} IncrementalSearch;
+
+void arena_init(Arena *arena, void *memory, size_t capacity);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_reset(Arena *arena);
+size_t search_scratch_size(int width, int height, int threads);
+
+int allocate_bitmap(Image *image);
+int free_bitmap(Image *image);
+int parse_bitmap(const char *filename, Image *dst, const RowSink *sink);
+int parse_image(Image *dst, const char *filename);
+int parse_image_region(Image *dst, const char *filename, Region *region, uint64_t *bytes_read);
+int test_file(const char *filename);
+int write_binary_bitmap(const Image *image, const char *filename);
+
+int line_precedes(const Line *line, const Line *other);
+int search_all_lines(const Image *image, int lines_type, LineHandler handler, void *context);
+int search_longest_line(SearchContext *context, const Image *image, Line *result, int line_type);
+int search_longest_line_in_file(SearchContext *context, const char *filename, Line *result, int line_type);
+int search_biggest_square(SearchContext *context, const Image *image, Square *result);
+int search_all_figures(SearchContext *context, const Image *image, Line *horizontal, Line *vertical, Square *square);
+int search_top_lines(const Image *image, int line_type, int count, int min_length, Line *result);
+int search_all_squares(SearchContext *context, const Image *image, int min_size, SquareHandler handler, void *handler_context);
+int search_top_squares(SearchContext *context, const Image *image, int count, int min_size, Square *result);
+int search_longest_diagonal(SearchContext *context, const Image *image, Line *result);
+int search_biggest_filled_square(SearchContext *context, const Image *image, Square *result);
+int search_biggest_filled_rectangle(SearchContext *context, const Image *image, Rectangle *result);
+int search_biggest_rectangle(SearchContext *context, const Image *image, Rectangle *result);
+int search_figures_in_file(SearchContext *context, const char *filename, size_t memory_limit, Line *horizontal, Line *vertical,
+    Square *square);
+
+int incremental_search_init(IncrementalSearch *search, const Image *image);
+void incremental_search_free(IncrementalSearch *search);
+int incremental_set_pixel(IncrementalSearch *search, int row, int col, int value);
+int incremental_apply_patch(IncrementalSearch *search, int row, int col, const Image *patch);
+int incremental_search_result(const IncrementalSearch *search, Line *horizontal, Line *vertical, Square *square);
+
+int build_index(const char *filename);
+int load_index(const char *filename, Line *horizontal, Line *vertical, Square *square, uint64_t *bytes_read);
+
+#endif
@@ -0,0 +1,366 @@
+/**
+ * @author Behari Youssef
+ * @name Figsearch
+ * @date 29 November 2024
+ * @file figsearch_bench.c
+ * @version 1.0
+ *
+ * Description:
+ * Benchmark of the figure search on the generated images.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "figsearch.h"
+
+#ifndef FIGSEARCH_VERSION
+#define FIGSEARCH_VERSION "unknown"
+#endif
+
+#define BENCH_SEED 0x9e3779b97f4a7c15ull
+#define BENCH_REPEATS 3
+#define BENCH_OUTPUT "bin/bench.json"
+
+/**
+ * @brief Structure, describes generator of the benchmark images.
+ *
+ * fill sets pixels of the cleared image, random state is seeded for each image,
+ * so the images are the same on each run. square_perimeter is the expected result of
+ * the square search on the image, the benchmark fails if it differs(-1 is not checked).
+ */
+typedef struct {
+    const char *name;
+    void (*fill)(Image *image, uint64_t *random);
+    int square_perimeter;
+} Generator;
+
+/**
+ * @brief Structure, describes size of the benchmark images.
+ */
+typedef struct {
+    int rows;
+    int cols;
+} BenchSize;
+
+/**
+ * @brief Returns next pseudo-random number(xorshift64*).
+ */
+static uint64_t next_random(uint64_t *random) {
+    *random ^= *random >> 12;
+    *random ^= *random << 25;
+    *random ^= *random >> 27;
+    return *random * 0x2545f4914f6cdd1dull;
+}
+
+/**
+ * @brief Random noise, each pixel is 1 with probability 1/2.
+ */
+static void fill_noise(Image *image, uint64_t *random) {
+    for (int row = 0; row < image->height; row++) {
+        BitmapWord *words = bitmap_row(image, row);
+        for (size_t word_idx = 0; word_idx < image->stride; word_idx++) {
+            words[word_idx] = next_random(random);
+        }
+        int tail = image->width % BITMAP_WORD_BITS;
+        if (tail) { // Padding bits must stay 0
+            words[image->stride - 1] &= ((BitmapWord)1 << tail) - 1;
+        }
+    }
+}
+
+/**
+ * @brief Sparse long lines, 1 line per 16 rows and 1 per 16 cols, each over half of the image.
+ */
+static void fill_sparse_lines(Image *image, uint64_t *random) {
+    for (int line = 0; line < image->height / 16; line++) {
+        int row = (int)(next_random(random) % (uint64_t)image->height);
+        int length = image->width / 2 + (int)(next_random(random) % (uint64_t)(image->width / 2 + 1));
+        int col = (int)(next_random(random) % (uint64_t)(image->width - length + 1));
+        for (int pixel = 0; pixel < length; pixel++) {
+            set_pixel(image, row, col + pixel, 1);
+        }
+    }
+    for (int line = 0; line < image->width / 16; line++) {
+        int col = (int)(next_random(random) % (uint64_t)image->width);
+        int length = image->height / 2 + (int)(next_random(random) % (uint64_t)(image->height / 2 + 1));
+        int row = (int)(next_random(random) % (uint64_t)(image->height - length + 1));
+        for (int pixel = 0; pixel < length; pixel++) {
+            set_pixel(image, row + pixel, col, 1);
+        }
+    }
+}
+
+/**
+ * @brief Nested hollow squares around the image center, 2 pixels apart.
+ */
+static void fill_nested_squares(Image *image, uint64_t *random) {
+    (void)random;
+    int size = image->height < image->width ? image->height : image->width;
+    for (int offset = 0; 2 * offset < size; offset += 2) {
+        int last = size - 1 - offset;
+        for (int pixel = offset; pixel <= last; pixel++) {
+            set_pixel(image, offset, pixel, 1);
+            set_pixel(image, last, pixel, 1);
+            set_pixel(image, pixel, offset, 1);
+            set_pixel(image, pixel, last, 1);
+        }
+    }
+}
+
+/**
+ * @brief Worst case of the square search, all pixels are 1 except 1 pixel of each row
+ * near the right border, so the big candidates fail on the last checks.
+ */
+static void fill_square_worst(Image *image, uint64_t *random) {
+    for (int row = 0; row < image->height; row++) {
+        BitmapWord *words = bitmap_row(image, row);
+        memset(words, 0xff, sizeof(BitmapWord) * image->stride);
+        int tail = image->width % BITMAP_WORD_BITS;
+        if (tail) {
+            words[image->stride - 1] &= ((BitmapWord)1 << tail) - 1;
+        }
+        int hole = image->width - 1 - (int)(next_random(random) % (uint64_t)(image->width / 8 + 1));
+        set_pixel(image, row, hole, 0);
+    }
+}
+
+/**
+ * @brief No 1 pixels, there is no square("Not found", the old search printed "-1 -1 -1 -1").
+ */
+static void fill_empty(Image *image, uint64_t *random) {
+    (void)image;
+    (void)random;
+}
+
+/**
+ * @brief Top and bottom rows of 1 pixels without side borders, the biggest square is 1 pixel.
+ *
+ * The old search did not check the side borders, it took the whole image as a square.
+ */
+static void fill_border_rows(Image *image, uint64_t *random) {
+    (void)random;
+    for (int col = 0; col < image->width; col++) {
+        set_pixel(image, 0, col, 1);
+        set_pixel(image, image->height - 1, col, 1);
+    }
+}
+
+static const Generator generators[] = {
+    {"noise", fill_noise, -1},
+    {"sparse_lines", fill_sparse_lines, -1},
+    {"nested_squares", fill_nested_squares, -1},
+    {"square_worst", fill_square_worst, -1},
+    {"empty", fill_empty, 0},
+    {"border_rows", fill_border_rows, 4},
+};
+
+static const BenchSize sizes[] = {{512, 512}, {2048, 2048}, {4096, 4096}};
+
+/**
+ * @brief Returns monotonic time in seconds.
+ */
+static double bench_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Writes image in the text format.
+ *
+ * @return 0 if file was written, 1 otherwise.
+ */
+static int write_text_bitmap(const Image *image, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        return 1;
+    }
+    char *line = malloc(2 * (size_t)image->width + 1);
+    if (line == NULL) {
+        fclose(file);
+        return 1;
+    }
+    fprintf(file, "%d %d\n", image->height, image->width);
+    for (int row = 0; row < image->height; row++) {
+        for (int col = 0; col < image->width; col++) {
+            line[2 * col] = get_pixel(image, row, col) ? '1' : '0';
+            line[2 * col + 1] = col + 1 < image->width ? ' ' : '\n';
+        }
+        fwrite(line, 1, 2 * (size_t)image->width, file);
+    }
+    free(line);
+    return fclose(file) != 0;
+}
+
+/**
+ * @brief Returns size of the file in bytes.
+ */
+static double file_size(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    double size = (double)ftell(file);
+    fclose(file);
+    return size;
+}
+
+/**
+ * @brief Structure, describes output of the benchmark results.
+ */
+typedef struct {
+    FILE *json;
+    int count;
+} BenchReport;
+
+/**
+ * @brief Reports one measured phase to stdout and to the JSON file.
+ *
+ * @param[in] report Pointer to report.
+ * @param[in] generator Generator name.
+ * @param[in] image Measured image.
+ * @param[in] phase Phase name.
+ * @param[in] seconds The best time of the phase.
+ * @param[in] bytes Count of read bytes(file or bitmap).
+ */
+static void report_phase(BenchReport *report, const char *generator, const Image *image, const char *phase, double seconds,
+    double bytes) {
+    double pixels = (double)image->height * (double)image->width;
+    double mb_per_s = seconds > 0 ? bytes / seconds / 1e6 : 0;
+    double mpixel_per_s = seconds > 0 ? pixels / seconds / 1e6 : 0;
+    printf("%-15s %5dx%-5d %-12s %10.6f s %10.1f MB/s %10.1f Mpixel/s\n", generator, image->height, image->width, phase, seconds,
+        mb_per_s, mpixel_per_s);
+    fprintf(report->json, "%s\n    {\"generator\": \"%s\", \"rows\": %d, \"cols\": %d, \"phase\": \"%s\", \"seconds\": %.9f, "
+        "\"bytes\": %.0f, \"mb_per_s\": %.3f, \"mpixel_per_s\": %.3f}", report->count ? "," : "", generator, image->height,
+        image->width, phase, seconds, bytes, mb_per_s, mpixel_per_s);
+    report->count++;
+}
+
+/**
+ * @brief Measures parse and search phases on one generated image.
+ *
+ * Each phase is run BENCH_REPEATS times, the best time is reported.
+ *
+ * @return 0 if all phases were successful, 1 otherwise.
+ */
+static int bench_image(BenchReport *report, const Generator *generator, const Image *image, SearchContext *context,
+    const char *directory) {
+    char text_name[256];
+    char binary_name[256];
+    snprintf(text_name, sizeof(text_name), "%s/figsearch_bench_%d.txt", directory, (int)getpid());
+    snprintf(binary_name, sizeof(binary_name), "%s/figsearch_bench_%d.bin", directory, (int)getpid());
+    if (write_text_bitmap(image, text_name) || write_binary_bitmap(image, binary_name)) {
+        remove(text_name);
+        remove(binary_name);
+        return 1;
+    }
+
+    const char *phases[] = {"parse_text", "parse_binary", "hline", "vline", "square"};
+    int status = 0;
+    Image parsed = EMPTY_IMAGE;
+    for (size_t phase = 0; phase < sizeof(phases) / sizeof(phases[0]) && !status; phase++) {
+        double best = -1;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+            Line line;
+            Square square;
+            double start = bench_time();
+            if (phase == 0 || phase == 1) {
+                status |= parse_image(&parsed, phase == 0 ? text_name : binary_name);
+            }
+            else if (phase == 4) {
+                int perimeter = search_biggest_square(context, image, &square);
+                if (perimeter == -1 || (generator->square_perimeter >= 0 && perimeter != generator->square_perimeter)) {
+                    fprintf(stderr, "Square search on %s image returned %d, expected %d\n", generator->name, perimeter,
+                        generator->square_perimeter);
+                    status = 1;
+                }
+            }
+            else {
+                status |= search_longest_line(context, image, &line, phase == 2 ? HORIZONTAL_LINE : VERTICAL_LINE) == -1;
+            }
+            double elapsed = bench_time() - start;
+            if (best < 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+        double bytes = (double)(sizeof(BitmapWord) * image->stride * (size_t)image->height); // Searchs read the bitmap
+        if (phase == 0 || phase == 1) {
+            bytes = file_size(phase == 0 ? text_name : binary_name);
+        }
+        report_phase(report, generator->name, image, phases[phase], best, bytes);
+    }
+    if (parsed.bitmap != NULL) {
+        free_bitmap(&parsed);
+    }
+    remove(text_name);
+    remove(binary_name);
+    return status;
+}
+
+/**
+ * @brief Entery point
+ *
+ * Usage: figsearch_bench [--quick] [--threads N] [--output file] [--tmp directory]
+ *
+ * @return 0 if benchmark was successful, 1 otherwise.
+ */
+int main(int argc, char *argv[]) {
+    const char *output = BENCH_OUTPUT;
+    const char *directory = "/tmp";
+    size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+    SearchContext context = {NULL, 1, NULL};
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--quick") == 0) { // Only the smaller sizes
+            size_count = 2;
+        }
+        else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            context.threads = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--output") == 0 && arg + 1 < argc) {
+            output = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--tmp") == 0 && arg + 1 < argc) {
+            directory = argv[++arg];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--quick] [--threads N] [--output file] [--tmp directory]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    BenchReport report = {fopen(output, "w"), 0};
+    if (report.json == NULL) {
+        fprintf(stderr, "Error opening file %s\n", output);
+        return 1;
+    }
+    fprintf(report.json, "{\n  \"version\": \"%s\",\n  \"threads\": %d,\n  \"repeats\": %d,\n  \"results\": [", FIGSEARCH_VERSION,
+        context.threads < 1 ? 1 : context.threads, BENCH_REPEATS);
+
+    int status = 0;
+    for (size_t size = 0; size < size_count && !status; size++) {
+        for (size_t generator = 0; generator < sizeof(generators) / sizeof(generators[0]) && !status; generator++) {
+            Image image = {.width = sizes[size].cols, .height = sizes[size].rows};
+            if (allocate_bitmap(&image)) {
+                status = 1;
+                break;
+            }
+            uint64_t random = BENCH_SEED ^ (uint64_t)(size * 16 + generator);
+            generators[generator].fill(&image, &random);
+            status = bench_image(&report, &generators[generator], &image, &context, directory);
+            free_bitmap(&image);
+        }
+    }
+    fprintf(report.json, "\n  ]\n}\n");
+    fclose(report.json);
+    if (status) {
+        fprintf(stderr, "Benchmark failed\n");
+    }
+    return status;
+}
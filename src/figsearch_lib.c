@@ -0,0 +1,4299 @@
+/**
+ * @author Behari Youssef
+ * @name Figsearch
+ * @date 29 November 2024
+ * @file figsearch_lib.c
+ * @version 1.0
+ *
+ * Description:
+ * Figure search library: bitmap parsing and storage, line and square searches.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "figsearch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIGSEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE static inline
+#endif
+
+#define READER_BUFFER_SIZE (1 << 20)
+#define PIXEL_END (-1)
+#define PIXEL_INVALID (-2)
+#define VLINE_TILE_WORDS 64
+#define BANDS_PER_THREAD 4
+#define BITMAP_REUSE_FACTOR 4
+#define BINARY_MAGIC "FIGBMP1"
+#define BINARY_MAGIC_SIZE 8
+#define BINARY_HEADER_SIZE 64
+#define BINARY_FLAG_CHECKSUM 1u
+#define CHECKSUM_SEED 0xcbf29ce484222325ull
+#define CHECKSUM_PRIME 0x100000001b3ull
+#define INDEX_MAGIC "FIGIDX1"
+#define INDEX_SUFFIX ".figidx"
+
+#define DECOMPRESSOR_MAGIC_SIZE 4
+#define PIPELINE_BLOCK_SIZE (256 * 1024)
+#define PIPELINE_BLOCKS 4
+#define PIPELINE_RING_BYTES (1 << 20)
+#define PIPELINE_MAX_ROWS 64
+#define RUNS_DIAGONALS 1
+#define RUNS_FILLED 2
+
+extern char **environ;
+
+/**
+ * @brief Structure, describes bounded ring of the fixed size slots passed from the producer thread to the consumer.
+ *
+ * Producer reserves the slot at head, fills it and publishes it. Consumer takes the slot at
+ * tail and releases it after use. head and tail count all published and released slots.
+ * Producer closes the ring at the end, failed stops both sides.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char *slots;
+    size_t *lengths;
+    size_t slot_size;
+    unsigned capacity;
+    unsigned head;
+    unsigned tail;
+    int closed;
+    int failed;
+} SlotRing;
+
+/**
+ * @brief Initializes ring of capacity slots of slot_size bytes.
+ *
+ * @return 0 if ring was initialized, 1 if allocation failed.
+ */
+static int slot_ring_init(SlotRing *ring, unsigned capacity, size_t slot_size) {
+    ring->slots = aligned_alloc(BITMAP_ALIGNMENT, (capacity * slot_size + BITMAP_ALIGNMENT - 1) / BITMAP_ALIGNMENT * BITMAP_ALIGNMENT);
+    ring->lengths = malloc(sizeof(size_t) * capacity);
+    if (ring->slots == NULL || ring->lengths == NULL) {
+        free(ring->slots);
+        free(ring->lengths);
+        return 1;
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+    ring->slot_size = slot_size;
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->closed = 0;
+    ring->failed = 0;
+    return 0;
+}
+
+static void slot_ring_destroy(SlotRing *ring) {
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->changed);
+    free(ring->slots);
+    free(ring->lengths);
+}
+
+/**
+ * @brief Waits for the free slot.
+ *
+ * @return slot to fill, NULL if the ring failed.
+ */
+static char *slot_ring_reserve(SlotRing *ring) {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->head - ring->tail == ring->capacity && !ring->failed) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    char *slot = ring->failed ? NULL : ring->slots + (size_t)(ring->head % ring->capacity) * ring->slot_size;
+    pthread_mutex_unlock(&ring->lock);
+    return slot;
+}
+
+/**
+ * @brief Passes the reserved slot with length bytes to the consumer.
+ */
+static void slot_ring_publish(SlotRing *ring, size_t length) {
+    pthread_mutex_lock(&ring->lock);
+    ring->lengths[ring->head % ring->capacity] = length;
+    ring->head++;
+    pthread_cond_signal(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/**
+ * @brief Waits for the published slot.
+ *
+ * @param[out] length Pointer to length of the slot.
+ * @return slot to use, NULL if the ring is closed and empty or failed.
+ */
+static const char *slot_ring_take(SlotRing *ring, size_t *length) {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->head == ring->tail && !ring->closed && !ring->failed) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    const char *slot = NULL;
+    if (ring->head != ring->tail && !ring->failed) {
+        slot = ring->slots + (size_t)(ring->tail % ring->capacity) * ring->slot_size;
+        *length = ring->lengths[ring->tail % ring->capacity];
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return slot;
+}
+
+/**
+ * @brief Returns the taken slot to the producer.
+ */
+static void slot_ring_release(SlotRing *ring) {
+    pthread_mutex_lock(&ring->lock);
+    ring->tail++;
+    pthread_cond_signal(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/**
+ * @brief Closes the ring by the producer, the consumer takes the rest of slots. If failed
+ * is set(by either side), both sides stop.
+ */
+static void slot_ring_close(SlotRing *ring, int failed) {
+    pthread_mutex_lock(&ring->lock);
+    ring->closed = 1;
+    ring->failed |= failed;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/**
+ * @brief Checks if the pipeline stages can run on separate CPUs.
+ */
+static int pipeline_enabled(void) {
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1;
+}
+
+/**
+ * @brief Structure, describes input reader over the bitmap file.
+ *
+ * Regular files are mapped to memory and scanned in place(data points to the mapping,
+ * file is NULL). Other files are read by blocks to the buffer. Compressed files are
+ * read from the pipe of the decompressor process(decompressor is its pid, 0 otherwise).
+ * Streams(stdin "-" and decompressor pipe) can not be seeked, if more CPUs are online
+ * they are read by the reader thread to the blocks ring, data points to the taken block.
+ * offset is position of the buffer in the input, filled is count of the bytes of all
+ * blocks read to the buffer or taken from the ring.
+ */
+typedef struct {
+    FILE *file;
+    char *buffer;
+    const char *data;
+    size_t size;
+    size_t position;
+    void *mapping;
+    size_t mapping_size;
+    uint64_t offset;
+    uint64_t filled;
+    pid_t decompressor;
+    int stream;
+    SlotRing *blocks;
+    pthread_t block_thread;
+} Reader;
+
+/**
+ * @brief Structure, describes external decompressor of the compressed format, recognized by magic bytes.
+ */
+typedef struct {
+    unsigned char magic[DECOMPRESSOR_MAGIC_SIZE];
+    size_t magic_size;
+    char *const *arguments;
+} Decompressor;
+
+static char *const gzip_arguments[] = {"gzip", "-dc", NULL};
+static char *const zstd_arguments[] = {"zstd", "-dcq", NULL};
+
+static const Decompressor decompressors[] = {
+    {{0x1f, 0x8b}, 2, gzip_arguments},
+    {{0x28, 0xb5, 0x2f, 0xfd}, 4, zstd_arguments},
+};
+
+/**
+ * @brief Tries to map whole regular file to memory.
+ *
+ * @param[out] reader Pointer to reader to initialize.
+ * @param[in] filename Name of the file to map.
+ * @return 0 if file was mapped.
+ * @return 1 if file can not be mapped(not regular file, empty file or mmap error).
+ */
+static int reader_map(Reader *reader, const char *filename) {
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor == -1) {
+        return 1;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) == -1 || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+        close(descriptor);
+        return 1;
+    }
+    void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor); // Mapping stays valid after close
+    if (mapping == MAP_FAILED) {
+        return 1;
+    }
+    posix_madvise(mapping, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+
+    reader->file = NULL;
+    reader->buffer = NULL;
+    reader->decompressor = 0;
+    reader->stream = 0;
+    reader->blocks = NULL;
+    reader->offset = 0;
+    reader->filled = 0;
+    reader->mapping = mapping;
+    reader->mapping_size = (size_t)info.st_size;
+    reader->data = mapping;
+    reader->size = (size_t)info.st_size;
+    reader->position = 0;
+    return 0;
+}
+
+/**
+ * @brief Closes reader and frees its buffer, waits for the decompressor.
+ *
+ * @param[in] reader Pointer to reader to close.
+ * @return 0 if reader was closed.
+ * @return 1 if decompressor failed(damaged compressed file), it is not failure if it was
+ * stopped by closing the pipe before the end of output.
+ */
+static int reader_close(Reader *reader) {
+    int status = 0;
+    if (reader->blocks != NULL) { // Stopping the reader thread, also if it waits for input
+        slot_ring_close(reader->blocks, 1);
+        pthread_cancel(reader->block_thread);
+        pthread_join(reader->block_thread, NULL);
+        slot_ring_destroy(reader->blocks);
+        free(reader->blocks);
+        reader->blocks = NULL;
+    }
+    if (reader->file != NULL && reader->file != stdin) {
+        fclose(reader->file);
+    }
+    reader->file = NULL;
+    if (reader->decompressor != 0) {
+        int exit_status;
+        if (waitpid(reader->decompressor, &exit_status, 0) == -1 ||
+            !((WIFEXITED(exit_status) && WEXITSTATUS(exit_status) == 0) || (WIFSIGNALED(exit_status) && WTERMSIG(exit_status) == SIGPIPE))) {
+            status = 1;
+        }
+        reader->decompressor = 0;
+    }
+    if (reader->mapping != NULL) {
+        munmap(reader->mapping, reader->mapping_size);
+        reader->mapping = NULL;
+    }
+    free(reader->buffer);
+    reader->buffer = NULL;
+    return status;
+}
+
+/**
+ * @brief Starts decompressor of the compressed file, its output is read from the pipe.
+ *
+ * Decompressor runs in its own process, so it decompresses the next blocks while the
+ * previous ones are parsed. SIGPIPE is set to default, so it ends if the reader is
+ * closed before the end of output.
+ *
+ * @param[out] reader Pointer to reader, file is set to the pipe.
+ * @param[in] filename Name of the file.
+ * @return 0 if decompressor was started.
+ * @return 1 if file is not compressed or can not be opened.
+ * @return -1 if decompressor can not be started.
+ */
+static int reader_spawn(Reader *reader, const char *filename) {
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor == -1) {
+        return 1;
+    }
+    unsigned char magic[DECOMPRESSOR_MAGIC_SIZE];
+    ssize_t length = pread(descriptor, magic, sizeof(magic), 0);
+    const Decompressor *decompressor = NULL;
+    for (size_t format = 0; format < sizeof(decompressors) / sizeof(decompressors[0]); format++) {
+        if (length >= (ssize_t)decompressors[format].magic_size &&
+            memcmp(magic, decompressors[format].magic, decompressors[format].magic_size) == 0) {
+            decompressor = &decompressors[format];
+        }
+    }
+    int pipe_ends[2];
+    if (decompressor == NULL || pipe(pipe_ends) == -1) {
+        close(descriptor);
+        return decompressor == NULL ? 1 : -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, descriptor, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipe_ends[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipe_ends[0]);
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigdefault(&attributes, &default_signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+    int error = posix_spawnp(&reader->decompressor, decompressor->arguments[0], &actions, &attributes,
+        decompressor->arguments, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    close(descriptor);
+    close(pipe_ends[1]);
+    if (error != 0) {
+        fprintf(stderr, "Error starting decompressor %s\n", decompressor->arguments[0]);
+        close(pipe_ends[0]);
+        reader->decompressor = 0;
+        return -1;
+    }
+    reader->file = fdopen(pipe_ends[0], "rb");
+    if (reader->file == NULL) {
+        close(pipe_ends[0]);
+        kill(reader->decompressor, SIGTERM);
+        waitpid(reader->decompressor, NULL, 0);
+        reader->decompressor = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads next block of the file.
+ *
+ * Streams are read without waiting for the full block(at least the binary header size
+ * or the rest of input), so parsing overlaps with the producer. Thread can be cancelled
+ * only while it waits for the stream.
+ *
+ * @param[in] reader Pointer to reader.
+ * @param[out] block Where bytes will stored be.
+ * @param[in] capacity Size of the block.
+ * @return count of read bytes, 0 at the end of file.
+ */
+static size_t reader_read_block(Reader *reader, char *block, size_t capacity) {
+    if (!reader->stream) {
+        return fread(block, 1, capacity, reader->file);
+    }
+    size_t size = 0;
+    ssize_t part;
+    do {
+        int cancel_state;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &cancel_state);
+        part = read(fileno(reader->file), block + size, capacity - size);
+        pthread_setcancelstate(cancel_state, NULL);
+        if (part > 0) {
+            size += (size_t)part;
+        }
+    } while ((part > 0 && size < BINARY_HEADER_SIZE) || (part == -1 && errno == EINTR));
+    return size;
+}
+
+/**
+ * @brief Reader thread, reads the stream to the blocks ring till its end.
+ */
+static void *reader_stage(void *argument) {
+    Reader *reader = argument;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    for (;;) {
+        char *block = slot_ring_reserve(reader->blocks);
+        size_t length = block != NULL ? reader_read_block(reader, block, PIPELINE_BLOCK_SIZE) : 0;
+        if (length == 0) { // End of stream or the reader was closed
+            break;
+        }
+        slot_ring_publish(reader->blocks, length);
+    }
+    slot_ring_close(reader->blocks, 0);
+    return NULL;
+}
+
+/**
+ * @brief Starts the reader thread of the stream.
+ *
+ * @return 0 if thread was started, 1 otherwise(stream is read by the parser).
+ */
+static int reader_start_stage(Reader *reader) {
+    reader->blocks = malloc(sizeof(SlotRing));
+    if (reader->blocks == NULL) {
+        return 1;
+    }
+    if (slot_ring_init(reader->blocks, PIPELINE_BLOCKS, PIPELINE_BLOCK_SIZE)) {
+        free(reader->blocks);
+        reader->blocks = NULL;
+        return 1;
+    }
+    if (pthread_create(&reader->block_thread, NULL, reader_stage, reader) != 0) {
+        slot_ring_destroy(reader->blocks);
+        free(reader->blocks);
+        reader->blocks = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens reader on the file.
+ *
+ * Compressed files(gzip, zstd) are decompressed while reading, "-" is standard input.
+ *
+ * @param[out] reader Pointer to reader to initialize.
+ * @param[in] filename Name of the file to read.
+ * @return 0 if reader was opened(everything went well).
+ * @return 1 if file can not be opened, decompressor can not be started or buffer can not be allocated.
+ */
+static int reader_open(Reader *reader, const char *filename) {
+    reader->decompressor = 0;
+    reader->offset = 0;
+    reader->filled = 0;
+    reader->mapping = NULL;
+    reader->mapping_size = 0;
+    reader->buffer = NULL;
+    reader->blocks = NULL;
+    reader->stream = 1;
+    int spawned = 0;
+    if (strcmp(filename, "-") == 0) { // Standard input
+        reader->file = stdin;
+    }
+    else {
+        spawned = reader_spawn(reader, filename);
+        if (spawned == -1) {
+            return 1;
+        }
+        if (spawned == 1 && reader_map(reader, filename) == 0) {
+            return 0;
+        }
+        if (spawned == 1) {
+            reader->stream = 0;
+            reader->file = fopen(filename, "rb");
+        }
+    }
+    if (reader->file == NULL) {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        return 1;
+    }
+    reader->data = NULL;
+    reader->size = 0;
+    reader->position = 0;
+    if (reader->stream && pipeline_enabled() && reader_start_stage(reader) == 0) {
+        return 0;
+    }
+    reader->buffer = malloc(READER_BUFFER_SIZE);
+    if (reader->buffer == NULL) {
+        reader_close(reader);
+        return 1;
+    }
+    reader->data = reader->buffer;
+    return 0;
+}
+
+/**
+ * @brief Reads next block of the file to the reader buffer, or takes it from the blocks ring.
+ *
+ * @param[in] reader Pointer to reader.
+ * @return count of bytes in the new block, 0 at the end of file.
+ */
+static size_t reader_fill(Reader *reader) {
+    if (reader->file == NULL) {
+        return 0;
+    }
+    reader->offset += reader->size;
+    if (reader->blocks != NULL) {
+        if (reader->size > 0) { // Previous block is read
+            slot_ring_release(reader->blocks);
+        }
+        size_t length = 0;
+        reader->data = slot_ring_take(reader->blocks, &length);
+        reader->size = length;
+    }
+    else {
+        reader->size = reader_read_block(reader, reader->buffer, READER_BUFFER_SIZE);
+    }
+    reader->filled += reader->size;
+    reader->position = 0;
+    return reader->size;
+}
+
+/**
+ * @brief Returns count of the input bytes read by the reader, call it before reader_close.
+ *
+ * Blocks of the buffered files and streams are counted whole. Mapped file is read only
+ * where the parser went, mapped is count of the mapped bytes the parser used.
+ */
+static uint64_t reader_bytes_read(const Reader *reader, uint64_t mapped) {
+    return reader->file == NULL ? mapped : reader->filled;
+}
+
+/**
+ * @brief Checks if the unread input starts with the bytes, nothing is consumed.
+ *
+ * Only the bytes already in the buffer(or mapping) are compared, the first block
+ * is read if the buffer is empty.
+ *
+ * @param[in] reader Pointer to reader.
+ * @param[in] bytes Bytes to compare.
+ * @param[in] count Count of bytes.
+ * @return 1 if input starts with the bytes, 0 otherwise.
+ */
+static int reader_starts_with(Reader *reader, const void *bytes, size_t count) {
+    if (reader->position == reader->size) {
+        reader_fill(reader);
+    }
+    return reader->size - reader->position >= count && memcmp(reader->data + reader->position, bytes, count) == 0;
+}
+
+/**
+ * @brief Reads bytes from the input.
+ *
+ * @param[in] reader Pointer to reader.
+ * @param[out] destination Where bytes will stored be.
+ * @param[in] count Count of bytes to read.
+ * @return count of read bytes, less than count at the end of input.
+ */
+static size_t reader_read_bytes(Reader *reader, void *destination, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        if (reader->position == reader->size && reader_fill(reader) == 0) {
+            break;
+        }
+        size_t part = reader->size - reader->position;
+        if (part > count - done) {
+            part = count - done;
+        }
+        memcpy((char *)destination + done, reader->data + reader->position, part);
+        reader->position += part;
+        done += part;
+    }
+    return done;
+}
+
+/**
+ * @brief Returns next character without consuming it.
+ *
+ * @param[in] reader Pointer to reader.
+ * @return next character or EOF.
+ */
+static inline int reader_peek(Reader *reader) {
+    if (reader->position == reader->size && reader_fill(reader) == 0) {
+        return EOF;
+    }
+    return (unsigned char)reader->data[reader->position];
+}
+
+/**
+ * @brief Skips white space characters, same as scanf does before number.
+ *
+ * @param[in] reader Pointer to reader.
+ * @return first not white space character(not consumed) or EOF.
+ */
+static inline int reader_skip_space(Reader *reader) {
+    for (;;) {
+        int c = reader_peek(reader);
+        if (c != ' ' && c != '\n' && c != '\t' && c != '\r' && c != '\v' && c != '\f') {
+            return c;
+        }
+        reader->position++;
+    }
+}
+
+/**
+ * @brief Moves reader to the byte offset from the start of the file.
+ *
+ * Streams can not be seeked, they are read and dropped till the offset, only the current
+ * block can be read again.
+ *
+ * @param[in] reader Pointer to reader.
+ * @param[in] offset Offset in bytes.
+ * @return 0 if reader was moved.
+ * @return 1 if offset is after the end of input, before the current stream block or seek failed.
+ */
+static int reader_seek(Reader *reader, uint64_t offset) {
+    if (reader->file == NULL) {
+        if (offset > reader->size) {
+            return 1;
+        }
+        reader->position = (size_t)offset;
+        return 0;
+    }
+    if (reader->stream) {
+        if (offset < reader->offset) { // Only the current block can be read again
+            return 1;
+        }
+        while (offset > reader->offset + reader->size) {
+            if (reader_fill(reader) == 0) {
+                return 1;
+            }
+        }
+        reader->position = (size_t)(offset - reader->offset);
+        return 0;
+    }
+    if (offset > (uint64_t)LONG_MAX || fseek(reader->file, (long)offset, SEEK_SET) != 0) {
+        return 1;
+    }
+    reader->offset = offset;
+    reader->size = 0;
+    reader->position = 0;
+    return 0;
+}
+
+/**
+ * @brief Reads header dimension, accepts the same input as scanf "%d".
+ *
+ * @param[in] reader Pointer to reader.
+ * @param[out] value Pointer to integer where value will stored be.
+ * @return 0 if number was read.
+ * @return 1 if there is no number or it is too big.
+ */
+static int reader_read_dimension(Reader *reader, int *value) {
+    int c = reader_skip_space(reader);
+    int negative = 0;
+    if (c == '+' || c == '-') {
+        negative = c == '-';
+        reader->position++;
+        c = reader_peek(reader);
+    }
+    if (c < '0' || c > '9') {
+        return 1;
+    }
+    long long number = 0;
+    while (c >= '0' && c <= '9') {
+        number = number * 10 + (c - '0');
+        if (number > INT_MAX) { // Does not fit to int
+            return 1;
+        }
+        reader->position++;
+        c = reader_peek(reader);
+    }
+    *value = negative ? (int)-number : (int)number;
+    return 0;
+}
+
+/**
+ * @brief Reads one pixel value, accepts the same numbers as scanf "%i".
+ *
+ * Fast path handles single '0' or '1' character, other forms(sign, octal or hex prefix)
+ * go through the generic number parsing.
+ *
+ * @param[in] reader Pointer to reader.
+ * @return 0 or 1 pixel value.
+ * @return PIXEL_END at the end of input.
+ * @return PIXEL_INVALID if value is not a number or is not 0 or 1.
+ */
+static inline int reader_read_pixel(Reader *reader) {
+    int c = reader_skip_space(reader);
+    if (c == EOF) {
+        return PIXEL_END;
+    }
+    if (c == '1' || c == '0') { // Fast path, "0" or "1" followed by separator
+        reader->position++;
+        int next = reader_peek(reader);
+        if (next == EOF || next == ' ' || next == '\n' || next == '\t' || next == '\r') {
+            return c - '0';
+        }
+        reader->position--;
+    }
+
+    int negative = 0;
+    if (c == '+' || c == '-') {
+        negative = c == '-';
+        reader->position++;
+        c = reader_peek(reader);
+    }
+    if (c < '0' || c > '9') {
+        return PIXEL_INVALID;
+    }
+
+    int base = 10;
+    if (c == '0') { // Octal or hex prefix
+        base = 8;
+        reader->position++;
+        c = reader_peek(reader);
+        if (c == 'x' || c == 'X') {
+            reader->position++;
+            c = reader_peek(reader);
+            if (!isxdigit(c)) {
+                return PIXEL_INVALID;
+            }
+            base = 16;
+        }
+    }
+
+    long value = 0;
+    for (;;) {
+        int digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        }
+        else if (base == 16 && isxdigit(c)) {
+            digit = tolower(c) - 'a' + 10;
+        }
+        else {
+            break;
+        }
+        if (digit >= base) {
+            break;
+        }
+        if (value <= 1) { // Bigger values are invalid anyway
+            value = value * base + digit;
+        }
+        reader->position++;
+        c = reader_peek(reader);
+    }
+    if (negative) {
+        value = -value;
+    }
+    return (value == 0 || value == 1) ? (int)value : PIXEL_INVALID;
+}
+
+/**
+ * @brief Checks if all pixels in the part of the row are set.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] row Row index.
+ * @param[in] col Index of the first col.
+ * @param[in] length Count of the pixels to check.
+ * @return 1 if all pixels are set, 0 otherwise.
+ */
+static inline int row_range_is_set(const Image *image, int row, int col, int length) {
+    const BitmapWord *words = bitmap_row(image, row);
+    int end = col + length; // First col after the range
+    while (col < end) { // Checking by words
+        int bit = col % BITMAP_WORD_BITS;
+        int count = BITMAP_WORD_BITS - bit;
+        if (count > end - col) {
+            count = end - col;
+        }
+        BitmapWord mask = (count == BITMAP_WORD_BITS) ? ~(BitmapWord)0 : (((BitmapWord)1 << count) - 1) << bit;
+        if ((words[col / BITMAP_WORD_BITS] & mask) != mask) {
+            return 0;
+        }
+        col += count;
+    }
+    return 1;
+}
+
+/**
+ * @brief Structure, describes word scanning kernels used by the line search.
+ *
+ * find_word_not returns index of the first word not equal to the pattern,
+ * find_word_change returns index of the first word different from the previous row.
+ * Both return count if there is no such word.
+ */
+typedef struct {
+    size_t (*find_word_not)(const BitmapWord *words, size_t count, BitmapWord pattern);
+    size_t (*find_word_change)(const BitmapWord *words, const BitmapWord *previous, size_t count);
+} ScanKernels;
+
+static size_t find_word_not_scalar(const BitmapWord *words, size_t count, BitmapWord pattern) {
+    size_t idx = 0;
+    while (idx < count && words[idx] == pattern) {
+        idx++;
+    }
+    return idx;
+}
+
+static size_t find_word_change_scalar(const BitmapWord *words, const BitmapWord *previous, size_t count) {
+    size_t idx = 0;
+    while (idx < count && words[idx] == previous[idx]) {
+        idx++;
+    }
+    return idx;
+}
+
+#ifdef FIGSEARCH_X86
+__attribute__((target("sse2")))
+static size_t find_word_not_sse2(const BitmapWord *words, size_t count, BitmapWord pattern) {
+    size_t idx = 0;
+    __m128i expected = _mm_set1_epi64x((long long)pattern);
+    for (; idx + 2 <= count; idx += 2) { // 2 words per step
+        __m128i block = _mm_loadu_si128((const __m128i *)(words + idx));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(block, expected)) != 0xFFFF) {
+            break;
+        }
+    }
+    return idx + find_word_not_scalar(words + idx, count - idx, pattern);
+}
+
+__attribute__((target("sse2")))
+static size_t find_word_change_sse2(const BitmapWord *words, const BitmapWord *previous, size_t count) {
+    size_t idx = 0;
+    for (; idx + 2 <= count; idx += 2) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(words + idx));
+        __m128i previous_block = _mm_loadu_si128((const __m128i *)(previous + idx));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(block, previous_block)) != 0xFFFF) {
+            break;
+        }
+    }
+    return idx + find_word_change_scalar(words + idx, previous + idx, count - idx);
+}
+
+__attribute__((target("avx2")))
+static size_t find_word_not_avx2(const BitmapWord *words, size_t count, BitmapWord pattern) {
+    size_t idx = 0;
+    __m256i expected = _mm256_set1_epi64x((long long)pattern);
+    for (; idx + 4 <= count; idx += 4) { // 4 words per step
+        __m256i difference = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(words + idx)), expected);
+        if (!_mm256_testz_si256(difference, difference)) {
+            break;
+        }
+    }
+    return idx + find_word_not_scalar(words + idx, count - idx, pattern);
+}
+
+__attribute__((target("avx2")))
+static size_t find_word_change_avx2(const BitmapWord *words, const BitmapWord *previous, size_t count) {
+    size_t idx = 0;
+    for (; idx + 4 <= count; idx += 4) {
+        __m256i difference = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(words + idx)),
+            _mm256_loadu_si256((const __m256i *)(previous + idx)));
+        if (!_mm256_testz_si256(difference, difference)) {
+            break;
+        }
+    }
+    return idx + find_word_change_scalar(words + idx, previous + idx, count - idx);
+}
+#endif
+
+static ScanKernels picked_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Picks the best scan kernels supported by the CPU, pthread_once callback.
+ */
+static void pick_scan_kernels(void) {
+    ScanKernels kernels = {find_word_not_scalar, find_word_change_scalar};
+#ifdef FIGSEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = (ScanKernels){find_word_not_avx2, find_word_change_avx2};
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        kernels = (ScanKernels){find_word_not_sse2, find_word_change_sse2};
+    }
+#endif
+    picked_kernels = kernels;
+}
+
+/**
+ * @brief Returns the best scan kernels supported by the CPU, they are picked only once.
+ *
+ * Search threads(batch workers, serve connections, library callers) can call it at the
+ * same time, pthread_once makes the table set before any of them reads it.
+ *
+ * @return Pointer to the picked kernels.
+ */
+static const ScanKernels *scan_kernels(void) {
+    pthread_once(&kernels_once, pick_scan_kernels);
+    return &picked_kernels;
+}
+
+/**
+ * @brief Frees space where bitmap was stored.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @return 0 if deallocation was successful(everything went well).
+ */
+int free_bitmap(Image *image) {
+    if (image->bitmap == NULL) {
+        return 1;
+    }
+    free(image->bitmap);
+    image->bitmap = NULL;
+    image->capacity = 0;
+    return 0;
+}
+
+/**
+ * @brief Allocating space for store bitmap.
+ *
+ * Whole bitmap is allocated by one aligned allocation and cleared to 0. Image must be
+ * EMPTY_IMAGE or hold bitmap from the previous allocation. Bitmap of the similar size
+ * (at most BITMAP_REUSE_FACTOR times bigger) is reused instead of new allocation.
+ *
+ * @param[in] image Pointer to image to store bitmap content in.
+ * @return 0 if allocation was successful(everything went well).
+ * @return 1 if allocation was not successful(malloc error).
+ */
+int allocate_bitmap(Image *image) {
+    image->stride = ((size_t)image->width + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS; // Words per row
+    if (image->stride > SIZE_MAX / sizeof(BitmapWord) / (size_t)image->height) { // Size overflow
+        return 1;
+    }
+    size_t bytes = image->stride * (size_t)image->height * sizeof(BitmapWord);
+    bytes = (bytes + BITMAP_ALIGNMENT - 1) / BITMAP_ALIGNMENT * BITMAP_ALIGNMENT; // aligned_alloc needs multiple of alignment
+
+    if (image->bitmap != NULL && image->capacity >= bytes && image->capacity / BITMAP_REUSE_FACTOR <= bytes) { // Reusing
+        memset(image->bitmap, 0, bytes);
+        return 0;
+    }
+    free_bitmap(image);
+
+    BitmapWord *allocated = aligned_alloc(BITMAP_ALIGNMENT, bytes);
+    if (allocated == NULL) {
+        return 1;
+    }
+    memset(allocated, 0, bytes);
+    image->bitmap = allocated;
+    image->capacity = bytes;
+    return 0;
+}
+
+/**
+ * @brief Rounds size up to the arena alignment.
+ */
+static inline size_t arena_align(size_t size) {
+    return (size + BITMAP_ALIGNMENT - 1) / BITMAP_ALIGNMENT * BITMAP_ALIGNMENT;
+}
+
+/**
+ * @brief Initializes arena on the caller owned memory.
+ *
+ * @param[out] arena Pointer to arena.
+ * @param[in] memory Memory block, it is not freed by the arena.
+ * @param[in] capacity Size of the memory block in bytes.
+ */
+void arena_init(Arena *arena, void *memory, size_t capacity) {
+    arena->memory = memory;
+    arena->capacity = capacity;
+    arena->used = 0;
+}
+
+/**
+ * @brief Allocates block from the arena, blocks are aligned to BITMAP_ALIGNMENT.
+ *
+ * @param[in] arena Pointer to arena.
+ * @param[in] size Size of the block in bytes.
+ * @return Pointer to the block or NULL if the arena is full.
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    uintptr_t base = (uintptr_t)arena->memory;
+    size_t offset = (size_t)(((base + arena->used + BITMAP_ALIGNMENT - 1) & ~(uintptr_t)(BITMAP_ALIGNMENT - 1)) - base);
+    if (offset > arena->capacity || arena_align(size) > arena->capacity - offset) {
+        return NULL;
+    }
+    arena->used = offset + arena_align(size);
+    return arena->memory + offset;
+}
+
+/**
+ * @brief Frees all blocks allocated from the arena.
+ *
+ * @param[in] arena Pointer to arena.
+ */
+void arena_reset(Arena *arena) {
+    arena->used = 0;
+}
+
+/**
+ * @brief Allocates scratch memory of the search, from the context arena or by malloc.
+ */
+static void *scratch_alloc(const SearchContext *context, size_t size) {
+    if (context != NULL && context->stats != NULL) {
+        context->stats->allocations++;
+        context->stats->allocated_bytes += size;
+    }
+    if (context != NULL && context->arena != NULL) {
+        return arena_alloc(context->arena, size);
+    }
+    return malloc(size);
+}
+
+/**
+ * @brief Frees scratch memory, arena blocks are freed by scratch_release.
+ */
+static void scratch_free(const SearchContext *context, void *memory) {
+    if (context == NULL || context->arena == NULL) {
+        free(memory);
+    }
+}
+
+/**
+ * @brief Returns arena position, scratch allocated after it is freed by scratch_release.
+ */
+static size_t scratch_mark(const SearchContext *context) {
+    return context != NULL && context->arena != NULL ? context->arena->used : 0;
+}
+
+static void scratch_release(const SearchContext *context, size_t mark) {
+    if (context != NULL && context->arena != NULL) {
+        context->arena->used = mark;
+    }
+}
+
+/**
+ * @brief Returns count of threads of the search context.
+ */
+static int context_threads(const SearchContext *context) {
+    if (context == NULL || context->threads < 1) {
+        return 1;
+    }
+    return context->threads < MAX_THREADS ? context->threads : MAX_THREADS;
+}
+
+/**
+ * @brief Returns count of bands of the parallel search.
+ */
+static int context_band_count(int threads, int rows) {
+    return threads * BANDS_PER_THREAD < rows ? threads * BANDS_PER_THREAD : rows;
+}
+
+/**
+ * @brief Structure, describes header of the binary bitmap file.
+ *
+ * Binary file is the header(BINARY_HEADER_SIZE bytes, little-endian numbers) followed by
+ * rows * stride bit-packed little-endian words, the same layout as Image bitmap.
+ * Checksum is computed over the words, it is checked only if BINARY_FLAG_CHECKSUM is set.
+ */
+typedef struct {
+    char magic[BINARY_MAGIC_SIZE];
+    uint32_t rows;
+    uint32_t cols;
+    uint64_t stride;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t checksum;
+    char padding[BINARY_HEADER_SIZE - 40];
+} BinaryHeader;
+
+_Static_assert(sizeof(BinaryHeader) == BINARY_HEADER_SIZE, "Binary header must have fixed size");
+
+/**
+ * @brief Converts little-endian 64-bit value to the host order and back.
+ */
+static inline uint64_t little_endian64(uint64_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(value);
+#else
+    return value;
+#endif
+}
+
+/**
+ * @brief Converts little-endian 32-bit value to the host order and back.
+ */
+static inline uint32_t little_endian32(uint32_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(value);
+#else
+    return value;
+#endif
+}
+
+/**
+ * @brief Adds words to the bitmap checksum(FNV-1a over 64-bit words).
+ *
+ * @param[in] checksum Checksum of the previous words, CHECKSUM_SEED at the start.
+ * @param[in] words Words to add, in host order.
+ * @param[in] count Count of words.
+ * @return new checksum.
+ */
+static uint64_t checksum_words(uint64_t checksum, const BitmapWord *words, size_t count) {
+    for (size_t word_idx = 0; word_idx < count; word_idx++) {
+        checksum = (checksum ^ words[word_idx]) * CHECKSUM_PRIME;
+    }
+    return checksum;
+}
+
+/**
+ * @brief Prepares storage for the rows and starts the sink.
+ *
+ * @param[in] rows Count of rows.
+ * @param[in] cols Count of cols.
+ * @param[out] dst Pointer to image where will bitmap stored be, or NULL.
+ * @param[in] sink Pointer to consumer of the rows, or NULL.
+ * @param[out] row_buffer Pointer to row storage used when dst is NULL.
+ * @return 0 if storage is ready.
+ * @return 1 if allocation failed or sink failed.
+ */
+static int begin_bitmap(int rows, int cols, Image *dst, const RowSink *sink, BitmapWord **row_buffer) {
+    *row_buffer = NULL;
+    if (dst != NULL) {
+        dst->height = rows;
+        dst->width = cols;
+        if (allocate_bitmap(dst)) {
+            return 1;
+        }
+    }
+    else if (sink != NULL) {
+        *row_buffer = malloc(sizeof(BitmapWord) * (((size_t)cols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS));
+        if (*row_buffer == NULL) {
+            return 1;
+        }
+    }
+    return sink != NULL ? sink->begin(sink->context, rows, cols) : 0;
+}
+
+/**
+ * @brief Reads text bitmap: "rows cols" header followed by rows * cols values 0 or 1.
+ *
+ * Every value is checked and packed right away.
+ *
+ * @param[in] reader Pointer to reader.
+ * @param[out] dst Pointer to image where will bitmap stored be, or NULL.
+ * @param[in] sink Pointer to consumer of the rows, or NULL.
+ * @return 0 if input contains correct bitmap definition(everything went well).
+ * @return 1 if input contains wrong bitmap definition, allocation failed or sink failed.
+ */
+static int parse_text_bitmap(Reader *reader, Image *dst, const RowSink *sink) {
+    int rows;
+    int cols;
+    if (reader_read_dimension(reader, &rows) || reader_read_dimension(reader, &cols) || rows <= 0 || cols <= 0) {
+        return 1;
+    }
+
+    BitmapWord *row_buffer; // Row storage when bitmap is not kept
+    int status = begin_bitmap(rows, cols, dst, sink, &row_buffer);
+    for (int row = 0; row < rows && status == 0; row++) { // For each row
+        BitmapWord *words = dst != NULL ? bitmap_row(dst, row) : row_buffer;
+        BitmapWord word = 0;
+        for (int col = 0; col < cols; col++) { // For each col in row
+            int value = reader_read_pixel(reader);
+            if (value < 0) { // Not 0 or 1, or not enough values
+                status = 1;
+                break;
+            }
+            word |= (BitmapWord)value << (col % BITMAP_WORD_BITS);
+            if (col % BITMAP_WORD_BITS == BITMAP_WORD_BITS - 1 || col == cols - 1) { // Word is full or row ends
+                if (words != NULL) {
+                    words[col / BITMAP_WORD_BITS] = word;
+                }
+                word = 0;
+            }
+        }
+        if (status == 0 && sink != NULL) {
+            status = sink->row(sink->context, row, words);
+        }
+    }
+
+    if (status == 0 && reader_read_pixel(reader) != PIXEL_END) { // More values or garbage after the bitmap
+        status = 1;
+    }
+    free(row_buffer);
+    return status;
+}
+
+/**
+ * @brief Reads binary bitmap, see BinaryHeader.
+ *
+ * Stored bitmap is read by one copy. Header, padding bits, file size and checksum are checked.
+ *
+ * @param[in] reader Pointer to reader.
+ * @param[out] dst Pointer to image where will bitmap stored be, or NULL.
+ * @param[in] sink Pointer to consumer of the rows, or NULL.
+ * @return 0 if input contains correct bitmap(everything went well).
+ * @return 1 if input is damaged, allocation failed or sink failed.
+ */
+static int parse_binary_bitmap(Reader *reader, Image *dst, const RowSink *sink) {
+    BinaryHeader header;
+    if (reader_read_bytes(reader, &header, sizeof(header)) != sizeof(header)) {
+        return 1;
+    }
+    uint32_t rows = little_endian32(header.rows);
+    uint32_t cols = little_endian32(header.cols);
+    uint64_t stride = little_endian64(header.stride);
+    if (rows == 0 || cols == 0 || rows > INT_MAX || cols > INT_MAX || stride != ((uint64_t)cols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS) {
+        return 1;
+    }
+
+    BitmapWord *row_buffer;
+    BitmapWord *validation_buffer = NULL; // Row storage when file is only validated
+    int status = begin_bitmap((int)rows, (int)cols, dst, sink, &row_buffer);
+    if (status == 0 && dst == NULL && sink == NULL) {
+        validation_buffer = malloc(sizeof(BitmapWord) * stride);
+        status = validation_buffer == NULL;
+    }
+    if (status == 0 && dst != NULL) { // Whole bitmap by one read
+        size_t bytes = sizeof(BitmapWord) * stride * rows;
+        status = reader_read_bytes(reader, dst->bitmap, bytes) != bytes;
+    }
+
+    BitmapWord padding_mask = cols % BITMAP_WORD_BITS ? ~(BitmapWord)0 << (cols % BITMAP_WORD_BITS) : 0;
+    uint64_t checksum = CHECKSUM_SEED;
+    for (uint32_t row = 0; row < rows && status == 0; row++) {
+        BitmapWord *words = dst != NULL ? bitmap_row(dst, (int)row) : row_buffer != NULL ? row_buffer : validation_buffer;
+        if (dst == NULL && reader_read_bytes(reader, words, sizeof(BitmapWord) * stride) != sizeof(BitmapWord) * stride) {
+            status = 1;
+            break;
+        }
+        for (uint64_t word_idx = 0; word_idx < stride; word_idx++) {
+            words[word_idx] = little_endian64(words[word_idx]);
+        }
+        if (words[stride - 1] & padding_mask) { // Padding bits must be 0
+            status = 1;
+            break;
+        }
+        checksum = checksum_words(checksum, words, stride);
+        if (sink != NULL) {
+            status = sink->row(sink->context, (int)row, words);
+        }
+    }
+
+    char rest;
+    if (status == 0 && reader_read_bytes(reader, &rest, 1) != 0) { // Data after the bitmap
+        status = 1;
+    }
+    if (status == 0 && (little_endian32(header.flags) & BINARY_FLAG_CHECKSUM) && checksum != little_endian64(header.checksum)) {
+        status = 1;
+    }
+    free(row_buffer);
+    free(validation_buffer);
+    return status;
+}
+
+/**
+ * @brief Structure, describes search stage of the pipelined parsing.
+ *
+ * Parser copies packed rows to the rows ring, the search thread passes them to the sink,
+ * so the search of a row overlaps with parsing of the next rows.
+ */
+typedef struct {
+    const RowSink *sink;
+    SlotRing rows;
+    pthread_t thread;
+    int started;
+    int status;
+} RowPipeline;
+
+/**
+ * @brief Search thread, passes rows from the ring to the sink till the ring is closed.
+ */
+static void *row_stage(void *argument) {
+    RowPipeline *pipeline = argument;
+    const char *words;
+    size_t length;
+    for (int row = 0; (words = slot_ring_take(&pipeline->rows, &length)) != NULL; row++) {
+        pipeline->status = pipeline->sink->row(pipeline->sink->context, row, (const BitmapWord *)words);
+        slot_ring_release(&pipeline->rows);
+        if (pipeline->status) { // Parser stops too
+            slot_ring_close(&pipeline->rows, 1);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the sink and the search thread, the ring holds at most PIPELINE_RING_BYTES of rows.
+ */
+static int pipeline_begin(void *context, int rows, int cols) {
+    RowPipeline *pipeline = context;
+    if (pipeline->sink->begin(pipeline->sink->context, rows, cols)) {
+        return 1;
+    }
+    size_t row_size = sizeof(BitmapWord) * (((size_t)cols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS);
+    size_t capacity = PIPELINE_RING_BYTES / row_size;
+    capacity = capacity < 2 ? 2 : capacity > PIPELINE_MAX_ROWS ? PIPELINE_MAX_ROWS : capacity;
+    if (slot_ring_init(&pipeline->rows, (unsigned)capacity, row_size)) {
+        return 1;
+    }
+    if (pthread_create(&pipeline->thread, NULL, row_stage, pipeline) != 0) {
+        slot_ring_destroy(&pipeline->rows);
+        return 1;
+    }
+    pipeline->started = 1;
+    return 0;
+}
+
+/**
+ * @brief Passes the parsed row to the search thread, waits if the ring is full.
+ */
+static int pipeline_row(void *context, int row, const BitmapWord *words) {
+    RowPipeline *pipeline = context;
+    (void)row; // Rows come in order
+    char *slot = slot_ring_reserve(&pipeline->rows);
+    if (slot == NULL) { // Sink failed
+        return 1;
+    }
+    memcpy(slot, words, pipeline->rows.slot_size);
+    slot_ring_publish(&pipeline->rows, pipeline->rows.slot_size);
+    return 0;
+}
+
+/**
+ * @brief Waits for the search thread, the rest of rows is searched unless parsing failed.
+ *
+ * @return 0 if all rows were passed to the sink, 1 if sink failed.
+ */
+static int pipeline_finish(RowPipeline *pipeline, int failed) {
+    if (!pipeline->started) {
+        return 0;
+    }
+    slot_ring_close(&pipeline->rows, failed);
+    pthread_join(pipeline->thread, NULL);
+    slot_ring_destroy(&pipeline->rows);
+    return pipeline->status != 0;
+}
+
+/**
+ * @brief Reads and validates bitmap file in one pass.
+ *
+ * File is text bitmap or binary bitmap(recognized by BINARY_MAGIC). Packed rows are
+ * stored to dst and passed to the sink. If both are NULL, file is only validated and
+ * bitmap is not allocated. If only the sink is given and more CPUs are online, the sink
+ * runs on the search thread fed through the rows ring.
+ *
+ * @param[in] filename Name of the image file.
+ * @param[out] dst Pointer to image where will bitmap stored be, or NULL.
+ * @param[in] sink Pointer to consumer of the rows, or NULL.
+ * @return 0 if file contains correct bitmap definition(everything went well).
+ * @return 1 if file contains wrong bitmap definition, allocation failed or sink failed.
+ */
+int parse_bitmap(const char *filename, Image *dst, const RowSink *sink) {
+    Reader reader;
+    if (reader_open(&reader, filename)) {
+        return 1;
+    }
+
+    RowPipeline pipeline = {.sink = sink, .started = 0, .status = 0};
+    RowSink pipeline_sink = {pipeline_begin, pipeline_row, &pipeline};
+    int pipelined = sink != NULL && dst == NULL && pipeline_enabled();
+    const RowSink *rows_sink = pipelined ? &pipeline_sink : sink;
+    int status;
+    if (reader_starts_with(&reader, BINARY_MAGIC, BINARY_MAGIC_SIZE)) {
+        status = parse_binary_bitmap(&reader, dst, rows_sink);
+    }
+    else {
+        status = parse_text_bitmap(&reader, dst, rows_sink);
+    }
+    if (pipelined && pipeline_finish(&pipeline, status != 0)) {
+        status = 1;
+    }
+    if (reader_close(&reader)) { // Damaged compressed file
+        status = 1;
+    }
+    if (status != 0 && dst != NULL) {
+        free_bitmap(dst);
+    }
+    return status;
+}
+
+/**
+ * @brief Writes image to the binary bitmap file with checksum.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] filename Name of the binary file.
+ * @return 0 if file was written(everything went well).
+ * @return 1 if file can not be written.
+ */
+int write_binary_bitmap(const Image *image, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        return 1;
+    }
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, BINARY_MAGIC_SIZE);
+    header.rows = little_endian32((uint32_t)image->height);
+    header.cols = little_endian32((uint32_t)image->width);
+    header.stride = little_endian64(image->stride);
+    header.flags = little_endian32(BINARY_FLAG_CHECKSUM);
+    header.checksum = little_endian64(checksum_words(CHECKSUM_SEED, image->bitmap, image->stride * (size_t)image->height));
+
+    BitmapWord *row_buffer = malloc(sizeof(BitmapWord) * image->stride);
+    int status = row_buffer == NULL || fwrite(&header, sizeof(header), 1, file) != 1;
+    for (int row = 0; row < image->height && status == 0; row++) { // Rows in little-endian order
+        const BitmapWord *words = bitmap_row(image, row);
+        for (size_t word_idx = 0; word_idx < image->stride; word_idx++) {
+            row_buffer[word_idx] = little_endian64(words[word_idx]);
+        }
+        status = fwrite(row_buffer, sizeof(BitmapWord), image->stride, file) != image->stride;
+    }
+    free(row_buffer);
+    if (fclose(file) != 0) {
+        status = 1;
+    }
+    return status;
+}
+
+/**
+ * @brief Testing file for correct bitmap content.
+ *
+ * Checks if the file contains the correct bitmap definition.
+ *
+ * @param[in] filename Filename to test content in.
+ * @return 0 if file contains correct bitmap definition(test is passed).
+ * @return 1 if file contains wrong bitmap defenition(test is not passed).
+ */
+int test_file(const char *filename) {
+    return parse_bitmap(filename, NULL, NULL);
+}
+
+/**
+ * @brief Parses bitmap from file to image structure.
+ *
+ * Image must be EMPTY_IMAGE or hold bitmap, which is reused if possible.
+ *
+ * @param[in] filename Name of the image file.
+ * @param[out] dst Pointer to image where will bitmap stored be.
+ * @return 0 if parsing was successful(everything went well).
+ * @return 1 if parsing occurred with an error(error while parsing).
+ */
+int parse_image(Image *dst, const char *filename) {
+    return parse_bitmap(filename, dst, NULL);
+}
+
+/**
+ * @brief Creates line object.
+ *
+ * @param[in] row Start row.
+ * @param[in] col Start col.
+ * @param[in] length Line length.
+ * @param[in] line_type Line type.
+ * @return line object.
+ */
+static inline Line make_line(int row, int col, int length, int line_type) {
+    Line line = {{row, col}, length, line_type};
+    return line;
+}
+
+/**
+ * @brief Finds all horizontal lines in one packed row by bit scans over row words.
+ *
+ * Words made of only 0 or only 1 pixels are skipped by the vector kernel. In other words
+ * run starts and ends are taken as masks of the 0 to 1 and 1 to 0 changes, which are
+ * paired in order, so the loops depend only on the count of runs in the word.
+ *
+ * @param[in] words Row words.
+ * @param[in] stride Count of row words.
+ * @param[in] width Count of pixels in the row.
+ * @param[in] row Row index.
+ * @param[in] handler Callback for each line, lines go from left to right.
+ * @param[in] context Handler context.
+ * @return 0 or the value returned by the handler.
+ */
+KERNEL_INLINE int scan_row_runs(const BitmapWord *words, size_t stride, int width, int row, LineHandler handler, void *context) {
+    const ScanKernels *kernels = scan_kernels();
+    int run_start = 0; // Start col of the current run, valid if carry is 1
+    BitmapWord carry = 0; // Last pixel of the previous word
+    size_t word_idx = 0;
+    while (word_idx < stride) {
+        BitmapWord word = words[word_idx];
+        if (word == (BitmapWord)0 - carry) { // Nothing changes in this word, skipping the same ones
+            word_idx += kernels->find_word_not(words + word_idx, stride - word_idx, word);
+            continue;
+        }
+        int base = (int)word_idx * BITMAP_WORD_BITS;
+        BitmapWord shifted = word << 1 | carry; // Left neighbour of each pixel
+        BitmapWord starts = word & ~shifted;
+        BitmapWord ends = shifted & ~word;
+        if (carry) { // The first end closes the run open from the previous words
+            int status = handler(context, make_line(row, run_start, base + __builtin_ctzll(ends) - run_start, HORIZONTAL_LINE));
+            if (status) {
+                return status;
+            }
+            ends &= ends - 1;
+        }
+        while (ends) {
+            int start = __builtin_ctzll(starts);
+            int status = handler(context, make_line(row, base + start, __builtin_ctzll(ends) - start, HORIZONTAL_LINE));
+            if (status) {
+                return status;
+            }
+            starts &= starts - 1;
+            ends &= ends - 1;
+        }
+        if (starts) { // Run continues to the next word
+            run_start = base + __builtin_ctzll(starts);
+        }
+        carry = word >> (BITMAP_WORD_BITS - 1);
+        word_idx++;
+    }
+    if (carry) { // Line till the end of the row
+        return handler(context, make_line(row, run_start, width - run_start, HORIZONTAL_LINE));
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds vertical lines which start or end on the row.
+ *
+ * Row is compared with the previous one, only changed words are scanned for starting
+ * (0 to 1) and ending(1 to 0) runs. Runs ended on the row are passed to the handler.
+ * To close all runs at the end, call it once more with row of 0 pixels.
+ *
+ * @param[in] words Row words.
+ * @param[in] previous Words of the previous row(0 words for the first row).
+ * @param[in] count Count of words to scan.
+ * @param[in] first_col Col of the first bit of words.
+ * @param[in] row Row index.
+ * @param[in,out] run_start Start row of the current run in each col(indexed from first_col).
+ * @param[in] handler Callback for each ended line.
+ * @param[in] context Handler context.
+ * @return 0 or the value returned by the handler.
+ */
+KERNEL_INLINE int scan_row_changes(const BitmapWord *words, const BitmapWord *previous, size_t count, int first_col, int row,
+    int *run_start, LineHandler handler, void *context) {
+    const ScanKernels *kernels = scan_kernels();
+    size_t word_idx = 0;
+    for (;;) {
+        word_idx += kernels->find_word_change(words + word_idx, previous + word_idx, count - word_idx);
+        if (word_idx >= count) {
+            return 0;
+        }
+        BitmapWord starts = words[word_idx] & ~previous[word_idx];
+        BitmapWord ends = previous[word_idx] & ~words[word_idx];
+        int base = (int)word_idx * BITMAP_WORD_BITS;
+        while (ends) {
+            int col = base + __builtin_ctzll(ends);
+            int status = handler(context, make_line(run_start[col], first_col + col, row - run_start[col], VERTICAL_LINE));
+            if (status) {
+                return status;
+            }
+            ends &= ends - 1;
+        }
+        while (starts) {
+            run_start[base + __builtin_ctzll(starts)] = row;
+            starts &= starts - 1;
+        }
+        word_idx++;
+    }
+}
+
+/**
+ * @brief Calls handler for all lines of the type in the rows of image.
+ *
+ * Rows out of the range are treated as 0 pixels, so vertical lines are cut on the range
+ * borders. Vertical lines are searched in tiles of cols, each tile is read row by row.
+ * Inlined into the line kernels with constant lines_type and handler, so the branch on
+ * the type and the handler calls are resolved at compile time.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] lines_type Line type to find.
+ * @param[in] row_begin First row of the range.
+ * @param[in] row_end Row after the last row of the range.
+ * @param[in] handler Callback for each line.
+ * @param[in] context Handler context.
+ * @return 0 or the value returned by the handler.
+ */
+KERNEL_INLINE int scan_rows_lines(const Image *image, int lines_type, int row_begin, int row_end, LineHandler handler, void *context) {
+    if (lines_type == HORIZONTAL_LINE) {
+        for (int row = row_begin; row < row_end; row++) {
+            int status = scan_row_runs(bitmap_row(image, row), image->stride, image->width, row, handler, context);
+            if (status) {
+                return status;
+            }
+        }
+        return 0;
+    }
+
+    static const BitmapWord empty_words[VLINE_TILE_WORDS];
+    int run_start[VLINE_TILE_WORDS * BITMAP_WORD_BITS]; // Start row of the current run in each col of the tile
+    for (size_t tile = 0; tile < image->stride; tile += VLINE_TILE_WORDS) { // For each tile of cols
+        size_t tile_words = image->stride - tile < VLINE_TILE_WORDS ? image->stride - tile : VLINE_TILE_WORDS;
+        const BitmapWord *previous = empty_words;
+        for (int row = row_begin; row <= row_end; row++) { // One more row of 0 closes all runs
+            const BitmapWord *words = row < row_end ? bitmap_row(image, row) + tile : empty_words;
+            int status = scan_row_changes(words, previous, tile_words, (int)tile * BITMAP_WORD_BITS, row, run_start, handler, context);
+            if (status) {
+                return status;
+            }
+            previous = words;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Structure, describes line kernels specialized for one line type.
+ *
+ * scan_rows calls handler for all lines in the rows of a stored bitmap, longest_row is
+ * RowSink row callback of the longest line search, it takes rows of a stored bitmap or
+ * rows streamed by the parser. search_band searchs one band of the parallel search.
+ * Kernels are generated by LINE_KERNELS, so their loops do not check the line type.
+ */
+typedef struct {
+    int (*scan_rows)(const Image *image, int row_begin, int row_end, LineHandler handler, void *context);
+    int (*longest_row)(void *context, int row, const BitmapWord *words);
+    void (*search_band)(void *context, int band);
+} LineKernels;
+
+static const LineKernels line_kernels[2]; // Indexed by the line type, defined after the kernels
+
+/**
+ * @brief Picks the kernels for the line type, once per query.
+ */
+static inline const LineKernels *line_kernels_for(int line_type) {
+    return &line_kernels[line_type == HORIZONTAL_LINE ? HORIZONTAL_LINE : VERTICAL_LINE];
+}
+
+/**
+ * @brief Search all lines in image.
+ *
+ * Horizontal lines are passed row by row. Vertical lines are passed in tiles of cols,
+ * in each tile in order of their end row, use line_precedes to pick the first one.
+ * Search does not allocate memory.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] lines_type Line type to find.
+ * @param[in] handler Callback for each line.
+ * @param[in] context Handler context.
+ *
+ * @return 0 If function executing was without error(everything went well).
+ * @return -1 If image is empty.
+ * @return value returned by the handler if it stopped the search.
+ */
+int search_all_lines(const Image *image, int lines_type, LineHandler handler, void *context) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) { // If image contains data
+        return -1;
+    }
+    return line_kernels_for(lines_type)->scan_rows(image, 0, image->height, handler, context);
+}
+
+/**
+ * @brief Compares lines of the type by the search order, see line_precedes.
+ *
+ * Inlined with constant line_type into the line kernels.
+ */
+KERNEL_INLINE int lines_precede(const Line *line, const Line *other, int line_type) {
+    if (line->length != other->length) {
+        return line->length > other->length;
+    }
+    int line_major = line->start.x_coordinate, line_minor = line->start.y_coordinate;
+    int other_major = other->start.x_coordinate, other_minor = other->start.y_coordinate;
+    if (line_type == VERTICAL_LINE) { // Vertical lines are ordered by col first
+        line_major = line->start.y_coordinate;
+        line_minor = line->start.x_coordinate;
+        other_major = other->start.y_coordinate;
+        other_minor = other->start.x_coordinate;
+    }
+    if (line_major != other_major) {
+        return line_major < other_major;
+    }
+    return line_minor < other_minor;
+}
+
+/**
+ * @brief Compares lines by the search order.
+ *
+ * Longer line goes first. Lines with the same length go in the scan order:
+ * horizontal by row then col, vertical by col then row.
+ *
+ * @param[in] line Line to compare.
+ * @param[in] other Line to compare with.
+ * @return 1 if line goes before other, 0 otherwise.
+ */
+int line_precedes(const Line *line, const Line *other) {
+    return lines_precede(line, other, line->line_type);
+}
+
+/**
+ * @brief Structure, describes streaming search of the longest line.
+ *
+ * Horizontal search needs only the current row. Vertical search keeps start row of
+ * the current run and the previous row words, so memory is O(width).
+ */
+typedef struct {
+    const SearchContext *context;
+    int line_type;
+    int rows;
+    int width;
+    size_t stride;
+    int *run_start;
+    BitmapWord *previous;
+    Line longest;
+    Line first_pixel;
+    uint64_t segments;
+} LongestLineSearch;
+
+/**
+ * @brief Keeps the line of the type if it goes before the longest one.
+ */
+KERNEL_INLINE int keep_longest_line(LongestLineSearch *search, Line line, int line_type) {
+    search->segments++;
+    if (lines_precede(&line, &search->longest, line_type)) {
+        search->longest = line;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prepares longest line search for the image size, RowSink begin callback.
+ */
+static int longest_line_begin(void *context, int rows, int cols) {
+    LongestLineSearch *search = context;
+    search->rows = rows;
+    search->width = cols;
+    search->stride = ((size_t)cols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+    search->longest = EMPTY_LINE;
+    search->first_pixel = EMPTY_LINE;
+    search->run_start = NULL;
+    search->previous = NULL;
+    if (search->line_type == VERTICAL_LINE) {
+        search->run_start = scratch_alloc(search->context, sizeof(int) * (size_t)cols);
+        search->previous = scratch_alloc(search->context, sizeof(BitmapWord) * search->stride);
+        if (search->run_start == NULL || search->previous == NULL) {
+            return 1;
+        }
+        memset(search->previous, 0, sizeof(BitmapWord) * search->stride);
+    }
+    return 0;
+}
+
+/**
+ * @brief Processes one row of the longest line search, body of the longest_row kernels.
+ *
+ * @param[in] keep Kernel keeping the lines of the type.
+ */
+KERNEL_INLINE int longest_line_row(LongestLineSearch *search, int row, const BitmapWord *words, int line_type, LineHandler keep) {
+    if (line_type == HORIZONTAL_LINE) {
+        return scan_row_runs(words, search->stride, search->width, row, keep, search);
+    }
+
+    if (search->first_pixel.length == 0) { // First 1 pixel in the image, result for 1 pixel long lines
+        size_t word_idx = scan_kernels()->find_word_not(words, search->stride, 0);
+        if (word_idx < search->stride) {
+            int col = (int)word_idx * BITMAP_WORD_BITS + __builtin_ctzll(words[word_idx]);
+            search->first_pixel = make_line(row, col, 1, VERTICAL_LINE);
+        }
+    }
+    int status = scan_row_changes(words, search->previous, search->stride, 0, row, search->run_start, keep, search);
+    memcpy(search->previous, words, sizeof(BitmapWord) * search->stride);
+    return status;
+}
+
+/**
+ * @brief Finishes longest line search after the last row and frees the search.
+ *
+ * @param[in] search Pointer to search.
+ * @param[out] result Pointer to line where result line will stored be.
+ * @return length of the longest line.
+ */
+static int longest_line_finish(LongestLineSearch *search, Line *result) {
+    if (search->line_type == VERTICAL_LINE && search->run_start != NULL && search->previous != NULL) {
+        for (size_t word_idx = 0; word_idx < search->stride; word_idx++) { // Closing runs which end on the last row
+            for (BitmapWord open = search->previous[word_idx]; open; open &= open - 1) {
+                int col = (int)word_idx * BITMAP_WORD_BITS + __builtin_ctzll(open);
+                keep_longest_line(search, make_line(search->run_start[col], col, search->rows - search->run_start[col], VERTICAL_LINE),
+                    VERTICAL_LINE);
+            }
+        }
+        if (search->longest.length == 1) { // 1 pixel long vertical lines are taken in row order
+            search->longest = search->first_pixel;
+        }
+    }
+    scratch_free(search->context, search->run_start);
+    scratch_free(search->context, search->previous);
+    search->run_start = NULL;
+    search->previous = NULL;
+    if (search->context != NULL && search->context->stats != NULL) {
+        search->context->stats->pixels += (uint64_t)search->rows * (uint64_t)search->width;
+        search->context->stats->segments += search->segments;
+    }
+    *result = search->longest;
+    return search->longest.length;
+}
+
+/**
+ * @brief Searchs the longest line in image row by row on the calling thread.
+ */
+static int search_longest_line_rows(const SearchContext *context, const Image *image, Line *result, int line_type) {
+    LongestLineSearch search = {.context = context, .line_type = line_type};
+    if (longest_line_begin(&search, image->height, image->width)) {
+        longest_line_finish(&search, result);
+        return -1;
+    }
+    int (*longest_row)(void *context, int row, const BitmapWord *words) = line_kernels_for(line_type)->longest_row;
+    for (int row = 0; row < image->height; row++) {
+        longest_row(&search, row, bitmap_row(image, row));
+    }
+    return longest_line_finish(&search, result);
+}
+
+/**
+ * @brief Searchs the longest line in image file while the file is parsed.
+ *
+ * Bitmap is not stored, only O(width) memory is used.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] filename Name of the image file.
+ * @param[out] result Pointer to line where result line will stored be.
+ * @param[in] line_type Line type to finding.
+ *
+ * @return 0...n length of the longest line(everything went well).
+ * @return -1 if file is not correct or error occurred.
+ */
+int search_longest_line_in_file(SearchContext *context, const char *filename, Line *result, int line_type) {
+    size_t mark = scratch_mark(context);
+    LongestLineSearch search = {.context = context, .line_type = line_type};
+    RowSink sink = {longest_line_begin, line_kernels_for(line_type)->longest_row, &search};
+    int length = -1;
+    if (parse_bitmap(filename, NULL, &sink)) {
+        scratch_free(context, search.run_start);
+        scratch_free(context, search.previous);
+    }
+    else {
+        length = longest_line_finish(&search, result);
+    }
+    scratch_release(context, mark);
+    return length;
+}
+
+/**
+ * @brief Structure, describes queue of bands shared by the worker threads.
+ */
+typedef struct {
+    int band_count;
+    atomic_int next_band;
+    void (*work)(void *context, int band);
+    void *context;
+} BandQueue;
+
+static void *band_worker(void *argument) {
+    BandQueue *queue = argument;
+    for (;;) {
+        int band = atomic_fetch_add(&queue->next_band, 1);
+        if (band >= queue->band_count) {
+            return NULL;
+        }
+        queue->work(queue->context, band);
+    }
+}
+
+/**
+ * @brief Runs work for each band on the threads, bands are taken in order from the shared counter.
+ *
+ * Calling thread works too. If thread can not be created, the remaining threads do its work.
+ *
+ * @param[in] band_count Count of bands.
+ * @param[in] threads Count of threads to use.
+ * @param[in] work Function to call for each band.
+ * @param[in] context Work context.
+ */
+static void run_bands(int band_count, int threads, void (*work)(void *context, int band), void *context) {
+    BandQueue queue = {.band_count = band_count, .work = work, .context = context};
+    atomic_init(&queue.next_band, 0);
+    if (threads > band_count) {
+        threads = band_count;
+    }
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (; started < threads - 1; started++) { // Calling thread is the last worker
+        if (pthread_create(&workers[started], NULL, band_worker, &queue) != 0) {
+            break;
+        }
+    }
+    band_worker(&queue);
+    for (int worker = 0; worker < started; worker++) {
+        pthread_join(workers[worker], NULL);
+    }
+}
+
+/**
+ * @brief Returns first row of the band, rows are split to bands evenly.
+ */
+static inline int band_first_row(int rows, int band_count, int band) {
+    return (int)((long long)rows * band / band_count);
+}
+
+/**
+ * @brief Structure, describes result of the line search in one band of rows.
+ *
+ * longest is the longest line which does not touch band borders. Vertical lines which
+ * touch the borders are kept per col, so they can be stitched with the neighbour bands.
+ */
+typedef struct {
+    int row_begin;
+    int row_end;
+    Line longest;
+    int *top_length;
+    int *bottom_start;
+    uint64_t segments;
+} LineBand;
+
+/**
+ * @brief Structure, describes parallel line search.
+ */
+typedef struct {
+    const Image *image;
+    LineBand *bands;
+} LineBandSearch;
+
+/**
+ * @brief Keeps the line of the type found in the band, lines on the band borders are kept for stitching.
+ */
+KERNEL_INLINE int keep_band_line(LineBand *band, Line line, int line_type) {
+    band->segments++;
+    if (line_type == VERTICAL_LINE) {
+        int col = line.start.y_coordinate;
+        if (line.start.x_coordinate == band->row_begin) { // Can continue from the band above
+            band->top_length[col] = line.length;
+            return 0;
+        }
+        if (line.start.x_coordinate + line.length == band->row_end) { // Can continue to the band below
+            band->bottom_start[col] = line.start.x_coordinate;
+            return 0;
+        }
+    }
+    if (lines_precede(&line, &band->longest, line_type)) {
+        band->longest = line;
+    }
+    return 0;
+}
+
+/**
+ * @brief Generates the line kernels for one line type.
+ *
+ * Handlers are passed to the inlined scans as constants, so they are inlined into the
+ * scan loops too.
+ *
+ * @param name Suffix of the kernel names.
+ * @param line_type Line type of the kernels.
+ */
+#define LINE_KERNELS(name, line_type)                                                                                   \
+    static int scan_lines_##name(const Image *image, int row_begin, int row_end, LineHandler handler, void *context) { \
+        return scan_rows_lines(image, line_type, row_begin, row_end, handler, context);                               \
+    }                                                                                                                 \
+    static int keep_longest_##name(void *context, Line line) {                                                        \
+        return keep_longest_line(context, line, line_type);                                                           \
+    }                                                                                                                 \
+    static int longest_row_##name(void *context, int row, const BitmapWord *words) {                                  \
+        return longest_line_row(context, row, words, line_type, keep_longest_##name);                                 \
+    }                                                                                                                 \
+    static int keep_band_##name(void *context, Line line) {                                                           \
+        return keep_band_line(context, line, line_type);                                                              \
+    }                                                                                                                 \
+    static void search_band_##name(void *context, int band_idx) {                                                     \
+        LineBandSearch *search = context;                                                                             \
+        LineBand *band = &search->bands[band_idx];                                                                    \
+        scan_rows_lines(search->image, line_type, band->row_begin, band->row_end, keep_band_##name, band);            \
+    }
+
+LINE_KERNELS(horizontal, HORIZONTAL_LINE)
+LINE_KERNELS(vertical, VERTICAL_LINE)
+
+static const LineKernels line_kernels[2] = {
+    [HORIZONTAL_LINE] = {scan_lines_horizontal, longest_row_horizontal, search_band_horizontal},
+    [VERTICAL_LINE] = {scan_lines_vertical, longest_row_vertical, search_band_vertical},
+};
+
+/**
+ * @brief Finds first 1 pixel in row order.
+ *
+ * @return 1 pixel long vertical line on the pixel or EMPTY_LINE if there is no 1 pixel.
+ */
+static Line find_first_pixel(const Image *image) {
+    for (int row = 0; row < image->height; row++) {
+        const BitmapWord *words = bitmap_row(image, row);
+        size_t word_idx = scan_kernels()->find_word_not(words, image->stride, 0);
+        if (word_idx < image->stride) {
+            return make_line(row, (int)word_idx * BITMAP_WORD_BITS + __builtin_ctzll(words[word_idx]), 1, VERTICAL_LINE);
+        }
+    }
+    return EMPTY_LINE;
+}
+
+/**
+ * @brief Searchs the longest line in image on more threads.
+ *
+ * Image is split to bands of rows, each band is searched on its own. Vertical lines cut
+ * by the band borders are stitched after that, from the top band to the bottom one.
+ * Result is the same as the result of the search on one thread.
+ */
+static int search_longest_line_bands(const SearchContext *context, const Image *image, Line *result, int line_type, int threads) {
+    int band_count = context_band_count(threads, image->height);
+    int cols = image->width;
+    LineBand *bands = scratch_alloc(context, sizeof(LineBand) * (size_t)band_count);
+    int *border_runs = line_type == VERTICAL_LINE ? scratch_alloc(context, sizeof(int) * (2 * (size_t)band_count + 1) * (size_t)cols) : NULL;
+    if (bands == NULL || (line_type == VERTICAL_LINE && border_runs == NULL)) {
+        scratch_free(context, bands);
+        scratch_free(context, border_runs);
+        return -1;
+    }
+    for (int band = 0; band < band_count; band++) {
+        bands[band].row_begin = band_first_row(image->height, band_count, band);
+        bands[band].row_end = band_first_row(image->height, band_count, band + 1);
+        bands[band].longest = EMPTY_LINE;
+        bands[band].top_length = NULL;
+        bands[band].bottom_start = NULL;
+        bands[band].segments = 0;
+        if (border_runs != NULL) {
+            bands[band].top_length = border_runs + (size_t)2 * cols * band;
+            bands[band].bottom_start = bands[band].top_length + cols;
+            for (int col = 0; col < cols; col++) {
+                bands[band].top_length[col] = 0;
+                bands[band].bottom_start[col] = -1;
+            }
+        }
+    }
+
+    LineBandSearch search = {image, bands};
+    run_bands(band_count, threads, line_kernels_for(line_type)->search_band, &search);
+
+    Line longest = EMPTY_LINE;
+    int *open_start = border_runs != NULL ? border_runs + (size_t)2 * cols * band_count : NULL; // Start of the line open from the bands above
+    for (int band = 0; band < band_count; band++) {
+        if (line_precedes(&bands[band].longest, &longest)) {
+            longest = bands[band].longest;
+        }
+        if (context != NULL && context->stats != NULL) {
+            context->stats->segments += bands[band].segments;
+        }
+        if (border_runs == NULL) {
+            continue;
+        }
+        int row_begin = bands[band].row_begin;
+        int height = bands[band].row_end - row_begin;
+        for (int col = 0; col < cols; col++) { // Stitching lines crossing the top border of the band
+            int top_length = bands[band].top_length[col];
+            int start = band > 0 ? open_start[col] : -1;
+            int next_open = bands[band].bottom_start[col];
+            if (top_length > 0) {
+                if (start < 0) {
+                    start = row_begin;
+                }
+                if (top_length == height) { // Line goes through the whole band
+                    next_open = start;
+                }
+                else {
+                    Line line = make_line(start, col, row_begin + top_length - start, VERTICAL_LINE);
+                    if (line_precedes(&line, &longest)) {
+                        longest = line;
+                    }
+                }
+            }
+            else if (start >= 0) { // Line ended on the last row of the band above
+                Line line = make_line(start, col, row_begin - start, VERTICAL_LINE);
+                if (line_precedes(&line, &longest)) {
+                    longest = line;
+                }
+            }
+            open_start[col] = next_open;
+        }
+    }
+    if (border_runs != NULL) {
+        for (int col = 0; col < cols; col++) { // Closing lines which end on the last row
+            if (open_start[col] >= 0) {
+                Line line = make_line(open_start[col], col, image->height - open_start[col], VERTICAL_LINE);
+                if (line_precedes(&line, &longest)) {
+                    longest = line;
+                }
+            }
+        }
+        if (longest.length == 1) { // 1 pixel long vertical lines are taken in row order
+            longest = find_first_pixel(image);
+        }
+    }
+    scratch_free(context, border_runs);
+    scratch_free(context, bands);
+    if (context != NULL && context->stats != NULL) {
+        context->stats->pixels += (uint64_t)image->height * (uint64_t)cols;
+    }
+    *result = longest;
+    return longest.length;
+}
+
+/**
+ * @brief Searchs the longest line in image.
+ *
+ * If there are more longest lines, horizontal is the first in row order, vertical is
+ * the first in col order. 1 pixel long vertical line is the first in row order.
+ * Image is searched in bands of rows if the context has more threads.
+ *
+ * @param[in] context Search context, or NULL for 1 thread and malloc scratch.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] result Pointer to line where result line will stored be.
+ * @param[in] line_type Line type to finding.
+ *
+ * @return 0...n length of the longest line(everything went well).
+ * @return -1 if image definition is not correct or allocation failed.
+ */
+int search_longest_line(SearchContext *context, const Image *image, Line *result, int line_type) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) // Checking the image for rhe correct bitmap
+        return -1;
+
+    size_t mark = scratch_mark(context);
+    int threads = context_threads(context);
+    int length = threads > 1 && image->height > 1 ? search_longest_line_bands(context, image, result, line_type, threads)
+                                                  : search_longest_line_rows(context, image, result, line_type);
+    scratch_release(context, mark);
+    return length;
+}
+
+/**
+ * @brief Structure, describes longest lines found by the square search from its run tables.
+ *
+ * first_pixel is the first 1 pixel in row order, result for 1 pixel long vertical lines.
+ */
+typedef struct {
+    Line horizontal;
+    Line vertical;
+    Line first_pixel;
+} FigureLines;
+
+/**
+ * @brief Searchs biggest square with the top-left corner in the rows of image.
+ *
+ * Square is a figure with all 4 borders made of 1 pixels. Rows are processed from
+ * the bottom up with down-run(count of 1 pixels from the pixel downwards) and
+ * right-run(count of 1 pixels from the pixel to the right) tables of the current row.
+ * For each pixel the candidate sizes are tried from the biggest possible down and the
+ * first fitting one stops the check, sizes smaller than the best found are not tried.
+ * If there are more biggest squares, the first one(top-left) is the result.
+ *
+ * Candidate takes O(1) for the right border(down-run of the top-right pixel) and
+ * O(size / 64) for the bottom border(word-wise check of the packed row). Pixels which
+ * can be top-left corners of squares no bigger than the best one cost O(1), so on usual
+ * images the search is close to O(rows * cols). Worst case is O(rows * cols * min(rows, cols))
+ * candidates, when many pixels have long right and down runs but no big square, tables
+ * of the rows below would be needed to cut it and the search keeps O(cols) memory.
+ *
+ * If lines is not NULL, the longest lines starting in the rows are taken from the same
+ * run tables: right-run of the first pixel of the line is horizontal line length,
+ * down-run is vertical line length.
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] row_begin First row of the range.
+ * @param[in] row_end Row after the last row of the range.
+ * @param[in,out] down_run Down-runs of the row_end row(0 for the image end), changed by the search.
+ * @param[out] right_run Right-run table, width ints.
+ * @param[out] result Pointer to square where result square will stored be.
+ * @param[out] lines Pointer to lines found in the rows, or NULL.
+ * @param[in,out] candidates Count of the checked candidate squares is added to it, or NULL.
+ * @return size of the biggest square, 0 if there is no square.
+ */
+static int search_square_rows(const Image *image, int row_begin, int row_end, int *down_run, int *right_run, Square *result,
+    FigureLines *lines, uint64_t *candidates) {
+    int cols = image->width;
+    uint64_t tried = 0; // Count of the checked candidate squares
+
+    Square biggest_square = EMPTY_SQUARE;
+    int biggest_size = 0;
+    for (int row = row_end - 1; row >= row_begin; row--) { // From the bottom, so the down-runs are known
+        int run = 0;
+        for (int col = cols - 1; col >= 0; col--) { // Updating run tables for the current row
+            if (get_pixel(image, row, col)) {
+                down_run[col]++;
+                run++;
+            }
+            else {
+                down_run[col] = 0;
+                run = 0;
+            }
+            right_run[col] = run;
+        }
+
+        for (int col = cols - 1; lines != NULL && col >= 0; col--) { // Lines starting on the row
+            if (right_run[col] == 0) {
+                continue;
+            }
+            lines->first_pixel = make_line(row, col, 1, VERTICAL_LINE); // Last assigned is the top-left one
+            if (col == 0 || right_run[col - 1] == 0) {
+                Line line = make_line(row, col, right_run[col], HORIZONTAL_LINE);
+                if (line_precedes(&line, &lines->horizontal)) {
+                    lines->horizontal = line;
+                }
+            }
+            if (row == 0 || !get_pixel(image, row - 1, col)) {
+                Line line = make_line(row, col, down_run[col], VERTICAL_LINE);
+                if (line_precedes(&line, &lines->vertical)) {
+                    lines->vertical = line;
+                }
+            }
+        }
+
+        for (int col = cols - 1; col >= 0; col--) { // From the right, so the last found is the top-left one
+            int size = right_run[col] < down_run[col] ? right_run[col] : down_run[col]; // Top and left borders limit
+            for (; size > 0 && size >= biggest_size; size--) { // Same size is accepted, it is more top-left
+                tried++;
+                if (down_run[col + size - 1] >= size && row_range_is_set(image, row + size - 1, col, size)) { // Right and bottom borders
+                    biggest_size = size;
+                    biggest_square.start_point.x_coordinate = row;
+                    biggest_square.start_point.y_coordinate = col;
+                    biggest_square.end_point.x_coordinate = row + size - 1;
+                    biggest_square.end_point.y_coordinate = col + size - 1;
+                    break;
+                }
+            }
+        }
+    }
+    if (candidates != NULL) {
+        *candidates += tried;
+    }
+
+    *result = biggest_square;
+    return biggest_size;
+}
+
+/**
+ * @brief Structure, describes square search in one band of rows.
+ */
+typedef struct {
+    int row_begin;
+    int row_end;
+    int *top_ones;
+    int *down_run;
+    int *right_run;
+    int size;
+    uint64_t candidates;
+    Square square;
+    FigureLines lines;
+} SquareBand;
+
+/**
+ * @brief Structure, describes parallel square search.
+ */
+typedef struct {
+    const Image *image;
+    SquareBand *bands;
+    int with_lines;
+} SquareBandSearch;
+
+/**
+ * @brief Counts 1 pixels from the top of the band down in each col, first pass of the parallel search.
+ */
+static void count_band_top_ones(void *context, int band_idx) {
+    SquareBandSearch *search = context;
+    SquareBand *band = &search->bands[band_idx];
+    const Image *image = search->image;
+    for (size_t word_idx = 0; word_idx < image->stride; word_idx++) {
+        int base = (int)word_idx * BITMAP_WORD_BITS;
+        BitmapWord alive = ~(BitmapWord)0; // Cols where all pixels from the band top are 1
+        int row = band->row_begin;
+        for (; row < band->row_end && alive; row++) {
+            BitmapWord ended = alive & ~bitmap_row(image, row)[word_idx];
+            for (; ended; ended &= ended - 1) {
+                int col = base + __builtin_ctzll(ended);
+                if (col < image->width) {
+                    band->top_ones[col] = row - band->row_begin;
+                }
+            }
+            alive &= bitmap_row(image, row)[word_idx];
+        }
+        for (; alive; alive &= alive - 1) { // Cols with 1 pixels in the whole band
+            int col = base + __builtin_ctzll(alive);
+            band->top_ones[col] = row - band->row_begin;
+        }
+    }
+}
+
+static void search_square_band(void *context, int band_idx) {
+    SquareBandSearch *search = context;
+    SquareBand *band = &search->bands[band_idx];
+    band->size = search_square_rows(search->image, band->row_begin, band->row_end, band->down_run, band->right_run,
+        &band->square, search->with_lines ? &band->lines : NULL, &band->candidates);
+}
+
+/**
+ * @brief Searchs biggest square(and longest lines) in bands of rows on the threads.
+ *
+ * Image is split to bands of rows. First pass counts 1 pixels from the top of each band,
+ * from these the down-runs on the bottom of each band are known. Second pass searches
+ * squares with the top-left corner in each band, squares can go down over the band border.
+ * Lines start in one band and their lengths come from the down-runs, so they need no stitching.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] result Pointer to square where result square will stored be.
+ * @param[out] lines Pointer to longest lines, or NULL if lines are not searched.
+ * @return size of the biggest square, 0 if there is no square.
+ * @return -1 if exectuion was not successful
+ */
+static int search_square_bands(const SearchContext *context, const Image *image, Square *result, FigureLines *lines) {
+    int threads = context_threads(context);
+    int band_count = threads > 1 ? context_band_count(threads, image->height) : 1;
+    int cols = image->width;
+    SquareBand *bands = scratch_alloc(context, sizeof(SquareBand) * (size_t)band_count);
+    int *runs = scratch_alloc(context, sizeof(int) * 3 * (size_t)band_count * (size_t)cols);
+    if (bands == NULL || runs == NULL) {
+        scratch_free(context, bands);
+        scratch_free(context, runs);
+        return -1;
+    }
+    for (int band = 0; band < band_count; band++) {
+        bands[band].row_begin = band_first_row(image->height, band_count, band);
+        bands[band].row_end = band_first_row(image->height, band_count, band + 1);
+        bands[band].top_ones = runs + (size_t)3 * cols * band;
+        bands[band].down_run = bands[band].top_ones + cols;
+        bands[band].right_run = bands[band].down_run + cols;
+        bands[band].candidates = 0;
+        bands[band].lines = (FigureLines){EMPTY_LINE, EMPTY_LINE, EMPTY_LINE};
+    }
+
+    SquareBandSearch search = {image, bands, lines != NULL};
+    if (band_count > 1) {
+        run_bands(band_count, threads, count_band_top_ones, &search);
+    }
+    for (int band = band_count - 1; band >= 0; band--) { // Down-runs below each band, from the bottom one
+        for (int col = 0; col < cols; col++) {
+            if (band == band_count - 1) {
+                bands[band].down_run[col] = 0;
+                continue;
+            }
+            SquareBand *below = &bands[band + 1];
+            int below_height = below->row_end - below->row_begin;
+            bands[band].down_run[col] = below->top_ones[col] == below_height ? below_height + below->down_run[col] : below->top_ones[col];
+        }
+    }
+    run_bands(band_count, threads, search_square_band, &search);
+
+    Square biggest_square = EMPTY_SQUARE;
+    int biggest_size = 0;
+    if (lines != NULL) {
+        *lines = (FigureLines){EMPTY_LINE, EMPTY_LINE, EMPTY_LINE};
+    }
+    for (int band = 0; band < band_count; band++) { // From the top band, so the first found is the top-left one
+        if (context != NULL && context->stats != NULL) {
+            context->stats->candidate_squares += bands[band].candidates;
+        }
+        if (bands[band].size > biggest_size) {
+            biggest_size = bands[band].size;
+            biggest_square = bands[band].square;
+        }
+        if (lines != NULL) {
+            if (line_precedes(&bands[band].lines.horizontal, &lines->horizontal)) {
+                lines->horizontal = bands[band].lines.horizontal;
+            }
+            if (line_precedes(&bands[band].lines.vertical, &lines->vertical)) {
+                lines->vertical = bands[band].lines.vertical;
+            }
+            if (lines->first_pixel.length == 0) {
+                lines->first_pixel = bands[band].lines.first_pixel;
+            }
+        }
+    }
+    scratch_free(context, runs);
+    scratch_free(context, bands);
+    if (context != NULL && context->stats != NULL) {
+        context->stats->pixels += (uint64_t)image->height * (uint64_t)cols;
+    }
+    *result = biggest_square;
+    return biggest_size;
+}
+
+/**
+ * @brief Searchs biggest square in image.
+ *
+ * Image is searched in bands of rows if the context has more threads.
+ *
+ * @param[in] context Search context, or NULL for 1 thread and malloc scratch.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] result Pointer to square where result square will stored be.
+ * @return perimeter of the biggest square.
+ * @return 0 if there is no square.
+ * @return -1 if exectuion was not successful
+ */
+int search_biggest_square(SearchContext *context, const Image *image, Square *result) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL)
+        return -1;
+
+    size_t mark = scratch_mark(context);
+    int biggest_size = search_square_bands(context, image, result, NULL);
+    scratch_release(context, mark);
+    return biggest_size == -1 ? -1 : biggest_size * 4;
+}
+
+/**
+ * @brief Searchs longest horizontal line, longest vertical line and biggest square in one pass.
+ *
+ * All figures are taken from the same down-run and right-run tables of the square search.
+ * Results are the same as the search_longest_line and search_biggest_square results.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] horizontal Pointer to the longest horizontal line.
+ * @param[out] vertical Pointer to the longest vertical line.
+ * @param[out] square Pointer to the biggest square.
+ * @return perimeter of the biggest square, 0 if there is no square.
+ * @return -1 if exectuion was not successful
+ */
+int search_all_figures(SearchContext *context, const Image *image, Line *horizontal, Line *vertical, Square *square) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL)
+        return -1;
+
+    FigureLines lines;
+    size_t mark = scratch_mark(context);
+    int biggest_size = search_square_bands(context, image, square, &lines);
+    scratch_release(context, mark);
+    if (biggest_size == -1) {
+        return -1;
+    }
+    if (lines.vertical.length == 1) { // 1 pixel long vertical lines are taken in row order
+        lines.vertical = lines.first_pixel;
+    }
+    *horizontal = lines.horizontal;
+    *vertical = lines.vertical;
+    return biggest_size * 4;
+}
+
+/**
+ * @brief Structure, describes search of all figures while the file is parsed row by row.
+ *
+ * Lines are searched by the streaming longest line searchs. Squares are searched by
+ * their bottom-right corners: up-run(count of 1 pixels from the pixel upwards) of each col
+ * and left-run of the current row give the bottom, left and right borders. The top border
+ * is checked on the row kept in the window, the last window_rows rows are kept. Row leaving
+ * the window is written to the spill file if an up-run still reaches it, so it can be top
+ * border of a later square, and is read back from there.
+ */
+typedef struct {
+    const SearchContext *context;
+    size_t memory_limit;
+    LongestLineSearch horizontal;
+    LongestLineSearch vertical;
+    int width;
+    size_t stride;
+    int *up_run;
+    BitmapWord *window;
+    int window_rows;
+    BitmapWord *spilled_row; // Top border row read back from the spill file
+    FILE *spill;
+    int biggest_size;
+    Square biggest_square;
+    int limit_exceeded;
+    uint64_t candidates;
+} StripSearch;
+
+/**
+ * @brief Prepares search, window takes the memory left under the limit, RowSink begin callback.
+ */
+static int strip_search_begin(void *context, int rows, int cols) {
+    StripSearch *search = context;
+    if (longest_line_begin(&search->horizontal, rows, cols) || longest_line_begin(&search->vertical, rows, cols)) {
+        return 1;
+    }
+    search->width = cols;
+    search->stride = ((size_t)cols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+    size_t row_bytes = sizeof(BitmapWord) * search->stride;
+    size_t fixed = 2 * sizeof(int) * (size_t)cols + 2 * row_bytes; // Run tables of the searchs, previous and spilled rows
+    if (search->memory_limit < fixed + row_bytes) {
+        search->limit_exceeded = 1;
+        return 1;
+    }
+    size_t window_rows = (search->memory_limit - fixed) / row_bytes;
+    search->window_rows = window_rows < (size_t)rows ? (int)window_rows : rows;
+    search->up_run = scratch_alloc(search->context, sizeof(int) * (size_t)cols);
+    search->window = scratch_alloc(search->context, row_bytes * (size_t)search->window_rows);
+    search->spilled_row = scratch_alloc(search->context, row_bytes);
+    if (search->up_run == NULL || search->window == NULL || search->spilled_row == NULL) {
+        return 1;
+    }
+    memset(search->up_run, 0, sizeof(int) * (size_t)cols);
+    return 0;
+}
+
+/**
+ * @brief Writes the row leaving the window to the spill file at its row offset.
+ * @return 0 if row is written, 1 if error occurred.
+ */
+static int strip_spill_row(StripSearch *search, int row, const BitmapWord *words) {
+    if (search->spill == NULL) {
+        search->spill = tmpfile();
+        if (search->spill == NULL) {
+            return 1;
+        }
+    }
+    size_t row_bytes = sizeof(BitmapWord) * search->stride;
+    ssize_t written = pwrite(fileno(search->spill), words, row_bytes, (off_t)row * (off_t)row_bytes);
+    return written != (ssize_t)row_bytes;
+}
+
+/**
+ * @brief Gives the kept row, from the window or read back from the spill file.
+ * @return pointer to the row words, NULL if error occurred.
+ */
+static const BitmapWord *strip_kept_row(StripSearch *search, int current_row, int row) {
+    if (current_row - row < search->window_rows) {
+        return search->window + (size_t)(row % search->window_rows) * search->stride;
+    }
+    size_t row_bytes = sizeof(BitmapWord) * search->stride;
+    ssize_t length = pread(fileno(search->spill), search->spilled_row, row_bytes, (off_t)row * (off_t)row_bytes);
+    return length == (ssize_t)row_bytes ? search->spilled_row : NULL;
+}
+
+/**
+ * @brief Processes one row, RowSink row callback.
+ *
+ * Square with the bottom-right corner on the row is accepted only if it is bigger than
+ * the biggest found, so of the same size squares the first(top-left) one is kept.
+ */
+static int strip_search_row(void *context, int row, const BitmapWord *words) {
+    StripSearch *search = context;
+    if (longest_row_horizontal(&search->horizontal, row, words) || longest_row_vertical(&search->vertical, row, words)) {
+        return 1;
+    }
+
+    int longest_up_run = 0;
+    for (size_t word_idx = 0; word_idx < search->stride; word_idx++) { // Updating up-runs
+        BitmapWord word = words[word_idx];
+        int base = (int)word_idx * BITMAP_WORD_BITS;
+        int count = search->width - base < BITMAP_WORD_BITS ? search->width - base : BITMAP_WORD_BITS;
+        for (int bit = 0; bit < count; bit++) {
+            int run = (word >> bit) & 1u ? search->up_run[base + bit] + 1 : 0;
+            search->up_run[base + bit] = run;
+            longest_up_run = run > longest_up_run ? run : longest_up_run;
+        }
+    }
+    BitmapWord *slot = search->window + (size_t)(row % search->window_rows) * search->stride;
+    int evicted = row - search->window_rows;
+    if (evicted >= 0 && longest_up_run > search->window_rows && strip_spill_row(search, evicted, slot)) {
+        return 1; // Evicted row is reached by an up-run, it can be top border of a later square
+    }
+    memcpy(slot, words, sizeof(BitmapWord) * search->stride);
+
+    const Image row_image = {search->width, 1, search->stride, (BitmapWord *)words, 0};
+    int left_run = 0;
+    for (int col = 0; col < search->width; col++) {
+        left_run = get_pixel(&row_image, 0, col) ? left_run + 1 : 0;
+        int size = left_run < search->up_run[col] ? left_run : search->up_run[col]; // Bottom and right borders limit
+        for (; size > search->biggest_size; size--) {
+            search->candidates++;
+            if (search->up_run[col - size + 1] < size) { // Left border
+                continue;
+            }
+            int top = row - size + 1;
+            const BitmapWord *top_words = strip_kept_row(search, row, top);
+            if (top_words == NULL) {
+                return 1;
+            }
+            Image top_row = {search->width, 1, search->stride, (BitmapWord *)top_words, 0};
+            if (row_range_is_set(&top_row, 0, col - size + 1, size)) {
+                search->biggest_size = size;
+                search->biggest_square = (Square){{top, col - size + 1}, {row, col}};
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Searchs longest lines and biggest square in image file with bounded memory.
+ *
+ * File is read once row by row and only the run tables and the last rows are kept, so
+ * images bigger than memory can be searched. Rows which are not used by the line searchs
+ * (O(width) memory) fill the window of the last rows for the square top borders. Older
+ * rows still reached by an up-run go to a temporary spill file, so squares higher than
+ * the window are found too. Results are the same as the search_all_figures results.
+ *
+ * @param[in] context Search context, or NULL. Threads are not used.
+ * @param[in] filename Name of the image file.
+ * @param[in] memory_limit Memory for the search tables and window in bytes.
+ * @param[out] horizontal Pointer to the longest horizontal line.
+ * @param[out] vertical Pointer to the longest vertical line.
+ * @param[out] square Pointer to the biggest square.
+ * @return perimeter of the biggest square, 0 if there is no square.
+ * @return -1 if file is not correct or error occurred.
+ * @return -2 if memory limit is too small for the run tables of the image width.
+ */
+int search_figures_in_file(SearchContext *context, const char *filename, size_t memory_limit, Line *horizontal, Line *vertical,
+    Square *square) {
+    size_t mark = scratch_mark(context);
+    StripSearch search = {.context = context, .memory_limit = memory_limit};
+    search.horizontal = (LongestLineSearch){.context = context, .line_type = HORIZONTAL_LINE};
+    search.vertical = (LongestLineSearch){.context = context, .line_type = VERTICAL_LINE};
+    search.biggest_square = EMPTY_SQUARE;
+    RowSink sink = {strip_search_begin, strip_search_row, &search};
+    int status = parse_bitmap(filename, NULL, &sink);
+    longest_line_finish(&search.horizontal, horizontal);
+    longest_line_finish(&search.vertical, vertical);
+    if (search.spill != NULL) {
+        fclose(search.spill);
+    }
+    scratch_free(context, search.up_run);
+    scratch_free(context, search.window);
+    scratch_free(context, search.spilled_row);
+    scratch_release(context, mark);
+    if (context != NULL && context->stats != NULL) {
+        context->stats->candidate_squares += search.candidates;
+    }
+    if (status) {
+        return search.limit_exceeded ? -2 : -1;
+    }
+    *square = search.biggest_square;
+    return search.biggest_size * 4;
+}
+
+/**
+ * @brief Structure, describes bounded heap of the first lines, the root is the last of them.
+ */
+typedef struct {
+    Line *lines;
+    int capacity;
+    int count;
+} LineHeap;
+
+/**
+ * @brief Moves the line at the index down until both children go before it.
+ */
+static void line_heap_sift_down(LineHeap *heap, int index) {
+    for (;;) {
+        int last = index;
+        for (int child = 2 * index + 1; child <= 2 * index + 2 && child < heap->count; child++) {
+            if (line_precedes(&heap->lines[last], &heap->lines[child])) { // Child goes later
+                last = child;
+            }
+        }
+        if (last == index) {
+            return;
+        }
+        Line swap = heap->lines[index];
+        heap->lines[index] = heap->lines[last];
+        heap->lines[last] = swap;
+        index = last;
+    }
+}
+
+/**
+ * @brief Adds line to the heap, if the heap is full the last line is dropped.
+ *
+ * @return 1 if line was kept, 0 if it goes after all lines of the full heap.
+ */
+static int line_heap_push(LineHeap *heap, Line line) {
+    if (heap->count < heap->capacity) {
+        int index = heap->count++;
+        while (index > 0 && line_precedes(&heap->lines[(index - 1) / 2], &line)) { // Parent goes before, moving it down
+            heap->lines[index] = heap->lines[(index - 1) / 2];
+            index = (index - 1) / 2;
+        }
+        heap->lines[index] = line;
+        return 1;
+    }
+    if (!line_precedes(&line, &heap->lines[0])) {
+        return 0;
+    }
+    heap->lines[0] = line;
+    line_heap_sift_down(heap, 0);
+    return 1;
+}
+
+/**
+ * @brief Sorts heap lines in place to the search order, heap is empty after that.
+ *
+ * @return count of lines.
+ */
+static int line_heap_sort(LineHeap *heap) {
+    int count = heap->count;
+    while (heap->count > 1) { // The last line goes to the end
+        Line last = heap->lines[0];
+        heap->lines[0] = heap->lines[--heap->count];
+        heap->lines[heap->count] = last;
+        line_heap_sift_down(heap, 0);
+    }
+    heap->count = 0;
+    return count;
+}
+
+/**
+ * @brief Structure, describes top lines search.
+ */
+typedef struct {
+    LineHeap heap;
+    int min_length;
+} TopLines;
+
+static int keep_top_line(void *context, Line line) {
+    TopLines *top = context;
+    if (line.length >= top->min_length) {
+        line_heap_push(&top->heap, line);
+    }
+    return 0;
+}
+
+/**
+ * @brief Searchs the first count longest lines of the type.
+ *
+ * Only count lines are kept in the bounded heap, result is in the search order(longest
+ * first, lines of the same length in the scan order).
+ *
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] line_type Line type to find.
+ * @param[in] count Count of lines to find.
+ * @param[in] min_length Minimal length of the found lines.
+ * @param[out] result Array of at least count lines.
+ * @return count of found lines.
+ * @return -1 if image is empty.
+ */
+int search_top_lines(const Image *image, int line_type, int count, int min_length, Line *result) {
+    TopLines top = {{result, count, 0}, min_length};
+    if (count <= 0) {
+        return 0;
+    }
+    if (search_all_lines(image, line_type, keep_top_line, &top) == -1) {
+        return -1;
+    }
+    return line_heap_sort(&top.heap);
+}
+
+/**
+ * @brief Structure, describes run-length tables of the bottom-up row sweep.
+ *
+ * For each col of the current row: count of 1 pixels going down(down_run), right(right_run),
+ * down-right(diagonal_run) and down-left(anti_diagonal_run) from the pixel, and size of the
+ * biggest filled square with top-left corner in the pixel(filled_size). Tables are updated
+ * from the row below in O(cols), optional tables are NULL if they were not requested.
+ */
+typedef struct {
+    const Image *image;
+    int row;
+    int *down_run;
+    int *right_run;
+    int *diagonal_run;
+    int *anti_diagonal_run;
+    int *filled_size;
+} RunTables;
+
+/**
+ * @brief Allocates run tables below the last row of the image.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[out] tables Pointer to run tables.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] kinds Optional tables, RUNS_DIAGONALS and RUNS_FILLED.
+ * @return 0 if tables were allocated, 1 otherwise.
+ */
+static int run_tables_init(const SearchContext *context, RunTables *tables, const Image *image, int kinds) {
+    size_t cols = (size_t)image->width;
+    size_t count = 2 + ((kinds & RUNS_DIAGONALS) ? 2 : 0) + ((kinds & RUNS_FILLED) ? 1 : 0);
+    int *runs = scratch_alloc(context, sizeof(int) * count * cols);
+    if (runs == NULL) {
+        return 1;
+    }
+    memset(runs, 0, sizeof(int) * count * cols);
+    tables->image = image;
+    tables->row = image->height;
+    tables->down_run = runs;
+    tables->right_run = runs + cols;
+    runs += 2 * cols;
+    tables->diagonal_run = NULL;
+    tables->anti_diagonal_run = NULL;
+    tables->filled_size = NULL;
+    if (kinds & RUNS_DIAGONALS) {
+        tables->diagonal_run = runs;
+        tables->anti_diagonal_run = runs + cols;
+        runs += 2 * cols;
+    }
+    if (kinds & RUNS_FILLED) {
+        tables->filled_size = runs;
+    }
+    return 0;
+}
+
+static void run_tables_free(const SearchContext *context, RunTables *tables) {
+    scratch_free(context, tables->down_run);
+}
+
+/**
+ * @brief Moves run tables one row up.
+ *
+ * Down-left runs and filled sizes are updated from the right, so the row below is still
+ * there for the next col. Down-right runs are updated from the left for the same reason.
+ */
+static void run_tables_up(RunTables *tables) {
+    const Image *image = tables->image;
+    int cols = image->width;
+    int row = --tables->row;
+    int run = 0;
+    int below_right = 0; // Filled size of the pixel below-right, before the update
+    for (int col = cols - 1; col >= 0; col--) {
+        int pixel = get_pixel(image, row, col);
+        run = pixel ? run + 1 : 0;
+        tables->right_run[col] = run;
+        tables->down_run[col] = pixel ? tables->down_run[col] + 1 : 0;
+        if (tables->anti_diagonal_run != NULL) {
+            tables->anti_diagonal_run[col] = pixel ? (col > 0 ? tables->anti_diagonal_run[col - 1] : 0) + 1 : 0;
+        }
+        if (tables->filled_size != NULL) {
+            int below = tables->filled_size[col];
+            int size = col + 1 < cols ? tables->filled_size[col + 1] : 0; // Right one is already updated
+            size = below < size ? below : size;
+            size = below_right < size ? below_right : size;
+            tables->filled_size[col] = pixel ? size + 1 : 0;
+            below_right = below;
+        }
+    }
+    for (int col = 0; tables->diagonal_run != NULL && col < cols; col++) {
+        int next = col + 1 < cols ? tables->diagonal_run[col + 1] : 0;
+        tables->diagonal_run[col] = get_pixel(image, row, col) ? next + 1 : 0;
+    }
+}
+
+/**
+ * @brief Calls handler for each square of the size at least min_size.
+ *
+ * Squares are passed as lines with the top-left corner as start and the square size as
+ * length, so line_precedes orders them as the square search does. Rows are processed from
+ * the bottom up on the run tables, min_size is read again after each found square, so the
+ * handler can raise it.
+ *
+ * @return 0 or the value returned by the handler.
+ * @return -1 if allocation failed.
+ */
+static int scan_squares(const SearchContext *context, const Image *image, const int *min_size, LineHandler handler, void *handler_context) {
+    RunTables tables;
+    if (run_tables_init(context, &tables, image, 0)) {
+        return -1;
+    }
+    const int *down_run = tables.down_run;
+    const int *right_run = tables.right_run;
+    int status = 0;
+    while (tables.row > 0 && status == 0) {
+        run_tables_up(&tables);
+        int row = tables.row;
+        for (int col = image->width - 1; col >= 0 && status == 0; col--) {
+            int size = right_run[col] < down_run[col] ? right_run[col] : down_run[col];
+            for (; size > 0 && size >= *min_size && status == 0; size--) {
+                if (down_run[col + size - 1] >= size && row_range_is_set(image, row + size - 1, col, size)) {
+                    status = handler(handler_context, make_line(row, col, size, HORIZONTAL_LINE));
+                }
+            }
+        }
+    }
+    run_tables_free(context, &tables);
+    return status;
+}
+
+/**
+ * @brief Structure, describes adapter of the square lines to the square handler.
+ */
+typedef struct {
+    SquareHandler handler;
+    void *context;
+} SquareLines;
+
+/**
+ * @brief Converts square line(top-left corner and size) to the square.
+ */
+static inline Square square_from_line(Line line) {
+    Square square = {line.start, {line.start.x_coordinate + line.length - 1, line.start.y_coordinate + line.length - 1}};
+    return square;
+}
+
+static int pass_square_line(void *context, Line line) {
+    SquareLines *squares = context;
+    return squares->handler(squares->context, square_from_line(line), line.length);
+}
+
+/**
+ * @brief Search all squares in image.
+ *
+ * Square is every top-left corner and size with all 4 borders made of 1 pixels, so
+ * squares can overlap. Squares are passed as they are found, rows from the bottom up.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] min_size Minimal size of the found squares.
+ * @param[in] handler Callback for each square.
+ * @param[in] handler_context Handler context.
+ * @return 0 If function executing was without error(everything went well).
+ * @return -1 If image is empty or allocation failed.
+ * @return value returned by the handler if it stopped the search.
+ */
+int search_all_squares(SearchContext *context, const Image *image, int min_size, SquareHandler handler, void *handler_context) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) {
+        return -1;
+    }
+    SquareLines squares = {handler, handler_context};
+    if (min_size < 1) {
+        min_size = 1;
+    }
+    size_t mark = scratch_mark(context);
+    int status = scan_squares(context, image, &min_size, pass_square_line, &squares);
+    scratch_release(context, mark);
+    return status;
+}
+
+/**
+ * @brief Structure, describes top squares search, min_size is raised when the heap is full.
+ */
+typedef struct {
+    LineHeap heap;
+    int min_size;
+} TopSquares;
+
+static int keep_top_square(void *context, Line line) {
+    TopSquares *top = context;
+    if (line_heap_push(&top->heap, line) && top->heap.count == top->heap.capacity) {
+        top->min_size = top->heap.lines[0].length; // Smaller squares can not get to the heap
+    }
+    return 0;
+}
+
+/**
+ * @brief Searchs the first count biggest squares.
+ *
+ * Only count squares are kept in the bounded heap, sizes smaller than the last kept square
+ * are not checked. Result is in the search order(biggest first, then top-left).
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[in] count Count of squares to find.
+ * @param[in] min_size Minimal size of the found squares.
+ * @param[out] result Array of at least count squares.
+ * @return count of found squares.
+ * @return -1 if image is empty or allocation failed.
+ */
+int search_top_squares(SearchContext *context, const Image *image, int count, int min_size, Square *result) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) {
+        return -1;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+    size_t mark = scratch_mark(context);
+    Line *lines = scratch_alloc(context, sizeof(Line) * (size_t)count);
+    if (lines == NULL) {
+        return -1;
+    }
+    TopSquares top = {{lines, count, 0}, min_size < 1 ? 1 : min_size};
+    int status = scan_squares(context, image, &top.min_size, keep_top_square, &top);
+    int found = line_heap_sort(&top.heap);
+    for (int square = 0; square < found; square++) {
+        result[square] = square_from_line(lines[square]);
+    }
+    scratch_free(context, lines);
+    scratch_release(context, mark);
+    return status == -1 ? -1 : found;
+}
+
+/**
+ * @brief Search longest diagonal line in image.
+ *
+ * Diagonal lines go down-right(DIAGONAL_LINE) or down-left(ANTI_DIAGONAL_LINE) from the
+ * start point, which is their top pixel. Longer line goes first, lines of the same length
+ * by start row, then col, down-right before down-left.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] result Pointer to line where result line will stored be.
+ * @return length of the longest diagonal line, 0 if there is no line.
+ * @return -1 if image is empty or allocation failed.
+ */
+int search_longest_diagonal(SearchContext *context, const Image *image, Line *result) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) {
+        return -1;
+    }
+    size_t mark = scratch_mark(context);
+    RunTables tables;
+    if (run_tables_init(context, &tables, image, RUNS_DIAGONALS)) {
+        scratch_release(context, mark);
+        return -1;
+    }
+    int cols = image->width;
+    Line longest = EMPTY_LINE;
+    while (tables.row > 0) { // From the bottom, a line of the same length in the upper row goes first
+        run_tables_up(&tables);
+        int row = tables.row;
+        for (int col = 0; col < cols; col++) { // From the left, the first line of the same length stays
+            int length = tables.diagonal_run[col];
+            if (length > longest.length || (length == longest.length && length > 0 && row < longest.start.x_coordinate)) {
+                if (row == 0 || col == 0 || !get_pixel(image, row - 1, col - 1)) { // Line starts here
+                    longest = make_line(row, col, length, DIAGONAL_LINE);
+                }
+            }
+            length = tables.anti_diagonal_run[col];
+            if (length > longest.length || (length == longest.length && length > 0 && row < longest.start.x_coordinate)) {
+                if (row == 0 || col == cols - 1 || !get_pixel(image, row - 1, col + 1)) {
+                    longest = make_line(row, col, length, ANTI_DIAGONAL_LINE);
+                }
+            }
+        }
+    }
+    run_tables_free(context, &tables);
+    scratch_release(context, mark);
+    *result = longest;
+    return longest.length;
+}
+
+/**
+ * @brief Search biggest filled square(all pixels are 1) in image.
+ *
+ * Squares of the same size go by the top-left corner, row first.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] result Pointer to square where result square will stored be.
+ * @return size of the biggest filled square, 0 if there is no square.
+ * @return -1 if image is empty or allocation failed.
+ */
+int search_biggest_filled_square(SearchContext *context, const Image *image, Square *result) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) {
+        return -1;
+    }
+    size_t mark = scratch_mark(context);
+    RunTables tables;
+    if (run_tables_init(context, &tables, image, RUNS_FILLED)) {
+        scratch_release(context, mark);
+        return -1;
+    }
+    int best_size = 0;
+    int best_row = -1;
+    int best_col = -1;
+    while (tables.row > 0) {
+        run_tables_up(&tables);
+        int row = tables.row;
+        for (int col = 0; col < image->width; col++) { // From the left, the first square of the same size stays
+            int size = tables.filled_size[col];
+            if (size > best_size || (size == best_size && size > 0 && row < best_row)) { // Upper row goes first
+                best_size = size;
+                best_row = row;
+                best_col = col;
+            }
+        }
+    }
+    run_tables_free(context, &tables);
+    scratch_release(context, mark);
+    Square square = EMPTY_SQUARE;
+    if (best_size > 0) {
+        square = (Square){{best_row, best_col}, {best_row + best_size - 1, best_col + best_size - 1}};
+    }
+    *result = square;
+    return best_size;
+}
+
+/**
+ * @brief Checks if the rectangle goes before the other one found with the size.
+ *
+ * Bigger size goes first, then the top-left corner(row first), then the wider one.
+ */
+static int rectangle_precedes(int size, const Rectangle *rectangle, int other_size, const Rectangle *other) {
+    if (size != other_size) {
+        return size > other_size;
+    }
+    if (rectangle->start_point.x_coordinate != other->start_point.x_coordinate) {
+        return rectangle->start_point.x_coordinate < other->start_point.x_coordinate;
+    }
+    if (rectangle->start_point.y_coordinate != other->start_point.y_coordinate) {
+        return rectangle->start_point.y_coordinate < other->start_point.y_coordinate;
+    }
+    return rectangle->end_point.y_coordinate > other->end_point.y_coordinate;
+}
+
+/**
+ * @brief Search biggest filled rectangle(all pixels are 1) by area in image.
+ *
+ * Down-runs of the row are histogram of the rectangles with the top border on the row,
+ * the widest rectangle of each bar height is found by stack of bars in O(cols).
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] result Pointer to rectangle where result rectangle will stored be.
+ * @return area of the biggest filled rectangle, 0 if there is no rectangle.
+ * @return -1 if image is empty or allocation failed.
+ */
+int search_biggest_filled_rectangle(SearchContext *context, const Image *image, Rectangle *result) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) {
+        return -1;
+    }
+    size_t mark = scratch_mark(context);
+    RunTables tables;
+    int *stack = scratch_alloc(context, sizeof(int) * ((size_t)image->width + 1));
+    if (stack == NULL || run_tables_init(context, &tables, image, 0)) {
+        scratch_release(context, mark);
+        return -1;
+    }
+    int cols = image->width;
+    int best_area = 0;
+    Rectangle best = {{-1, -1}, {-1, -1}};
+    while (tables.row > 0) {
+        run_tables_up(&tables);
+        int row = tables.row;
+        int depth = 0; // Bars with growing heights
+        for (int col = 0; col <= cols; col++) {
+            int height = col < cols ? tables.down_run[col] : 0;
+            while (depth > 0 && tables.down_run[stack[depth - 1]] >= height) { // Bar can not grow right
+                int bar_height = tables.down_run[stack[--depth]];
+                int left = depth > 0 ? stack[depth - 1] + 1 : 0;
+                Rectangle rectangle = {{row, left}, {row + bar_height - 1, col - 1}};
+                int area = bar_height * (col - left);
+                if (bar_height > 0 && rectangle_precedes(area, &rectangle, best_area, &best)) {
+                    best_area = area;
+                    best = rectangle;
+                }
+            }
+            stack[depth++] = col;
+        }
+    }
+    run_tables_free(context, &tables);
+    scratch_free(context, stack);
+    scratch_release(context, mark);
+    *result = best;
+    return best_area;
+}
+
+/**
+ * @brief Returns length of the run of 1 pixels from the pixel rightwards, at most limit.
+ */
+static inline int row_run_length(const Image *image, int row, int col, int limit) {
+    const BitmapWord *words = bitmap_row(image, row);
+    int length = 0;
+    while (length < limit) { // Counting by words
+        int bit = (col + length) % BITMAP_WORD_BITS;
+        BitmapWord zeros = ~words[(col + length) / BITMAP_WORD_BITS] >> bit;
+        if (zeros != 0) {
+            length += __builtin_ctzll(zeros);
+            break;
+        }
+        length += BITMAP_WORD_BITS - bit;
+    }
+    return length < limit ? length : limit;
+}
+
+/**
+ * @brief Builds tree of the biggest down-runs, leaves are the down-runs of the row cols.
+ */
+static void run_tree_build(int *nodes, int leaf_count, const int *down_run, int cols) {
+    for (int leaf = 0; leaf < leaf_count; leaf++) {
+        nodes[leaf_count + leaf] = leaf < cols ? down_run[leaf] : 0;
+    }
+    for (int node = leaf_count - 1; node >= 1; node--) {
+        int left = nodes[2 * node];
+        int right = nodes[2 * node + 1];
+        nodes[node] = left > right ? left : right;
+    }
+}
+
+/**
+ * @brief Finds the last col in [first, last] with down-run at least length, in O(log cols).
+ *
+ * @param[in] nodes Tree built by run_tree_build.
+ * @param[in] node Tree node, 1 is the root.
+ * @param[in] node_first First col under the node.
+ * @param[in] node_last Last col under the node.
+ * @return index of the col, -1 if there is no such col.
+ */
+static int run_tree_last(const int *nodes, int node, int node_first, int node_last, int first, int last, int length) {
+    if (node_last < first || node_first > last || nodes[node] < length) {
+        return -1;
+    }
+    if (node_first == node_last) {
+        return node_first;
+    }
+    int middle = node_first + (node_last - node_first) / 2;
+    int col = run_tree_last(nodes, 2 * node + 1, middle + 1, node_last, first, last, length); // Right part goes first
+    return col >= 0 ? col : run_tree_last(nodes, 2 * node, node_first, middle, first, last, length);
+}
+
+/**
+ * @brief Search biggest hollow rectangle(all 4 borders are 1 pixels) by perimeter in image.
+ *
+ * Rectangle is at least 2 pixels wide and high. For each top-left corner and height the
+ * bottom border run limits the width together with the top border run, the right border
+ * is the last col in that width whose down-run covers the height, found in the tree of
+ * the row down-runs. So each corner takes O(height * log cols), O(rows^2 * cols * log cols)
+ * in the worst case, candidates which can not be bigger than the found one are skipped.
+ *
+ * @param[in] context Search context, or NULL.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @param[out] result Pointer to rectangle where result rectangle will stored be.
+ * @return perimeter of the biggest rectangle, 0 if there is no rectangle.
+ * @return -1 if image is empty or allocation failed.
+ */
+int search_biggest_rectangle(SearchContext *context, const Image *image, Rectangle *result) {
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) {
+        return -1;
+    }
+    size_t mark = scratch_mark(context);
+    int leaf_count = 1;
+    while (leaf_count < image->width) {
+        leaf_count *= 2;
+    }
+    RunTables tables;
+    int *nodes = scratch_alloc(context, sizeof(int) * 2 * (size_t)leaf_count);
+    if (nodes == NULL || run_tables_init(context, &tables, image, 0)) {
+        scratch_release(context, mark);
+        return -1;
+    }
+    int best_half = 0; // Width + height
+    Rectangle best = {{-1, -1}, {-1, -1}};
+    uint64_t tried = 0;
+    while (tables.row > 0) {
+        run_tables_up(&tables);
+        run_tree_build(nodes, leaf_count, tables.down_run, image->width);
+        int row = tables.row;
+        for (int col = image->width - 1; col >= 0; col--) {
+            int top = tables.right_run[col];
+            if (top < 2) {
+                continue;
+            }
+            for (int height = tables.down_run[col]; height >= 2 && height + top >= best_half; height--) {
+                int bottom = row_run_length(image, row + height - 1, col, top); // Bottom border limits the width
+                if (bottom < 2 || bottom + height < best_half) {
+                    continue;
+                }
+                tried++;
+                int right = run_tree_last(nodes, 1, 0, leaf_count - 1, col + 1, col + bottom - 1, height);
+                if (right < 0) {
+                    continue;
+                }
+                int width = right - col + 1;
+                Rectangle rectangle = {{row, col}, {row + height - 1, right}};
+                if (rectangle_precedes(width + height, &rectangle, best_half, &best)) {
+                    best_half = width + height;
+                    best = rectangle;
+                }
+            }
+        }
+    }
+    run_tables_free(context, &tables);
+    scratch_free(context, nodes);
+    scratch_release(context, mark);
+    if (context != NULL && context->stats != NULL) {
+        context->stats->candidate_squares += tried;
+    }
+    *result = best;
+    return 2 * best_half;
+}
+
+/**
+ * @brief Returns size of the arena which is enough for any search of the image.
+ *
+ * Searchs free their scratch memory on return, so one arena of this size can be used
+ * for all searchs of the image one after another.
+ *
+ * @param[in] width Image width.
+ * @param[in] height Image height.
+ * @param[in] threads Count of threads of the search context.
+ * @return size in bytes.
+ */
+size_t search_scratch_size(int width, int height, int threads) {
+    size_t cols = width > 0 ? (size_t)width : 0;
+    size_t stride = (cols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    size_t line_bands = (size_t)context_band_count(threads, height > 1 ? height : 1);
+    size_t square_bands = threads > 1 ? line_bands : 1;
+
+    size_t size = arena_align(sizeof(int) * cols) + arena_align(sizeof(BitmapWord) * stride); // Vertical line rows
+    size_t bands_size = arena_align(sizeof(LineBand) * line_bands) + arena_align(sizeof(int) * (2 * line_bands + 1) * cols);
+    if (bands_size > size) {
+        size = bands_size;
+    }
+    size_t square_size = arena_align(sizeof(SquareBand) * square_bands) + arena_align(sizeof(int) * 3 * square_bands * cols);
+    if (square_size > size) {
+        size = square_size;
+    }
+    size_t runs_size = arena_align(sizeof(int) * 5 * cols) + arena_align(sizeof(int) * (cols + 1)); // Run tables and bar stack
+    if (runs_size > size) {
+        size = runs_size;
+    }
+    size_t leaf_count = 1;
+    while (leaf_count < cols) {
+        leaf_count *= 2;
+    }
+    size_t rectangle_size = arena_align(sizeof(int) * 2 * cols) + arena_align(sizeof(int) * 2 * leaf_count); // Down-run tree
+    if (rectangle_size > size) {
+        size = rectangle_size;
+    }
+    return size + BITMAP_ALIGNMENT; // Memory block does not need to be aligned
+}
+
+/**
+ * @brief Initializes tree of lines, all leaves are EMPTY_LINE.
+ *
+ * @return 0 if allocation was successful, 1 otherwise.
+ */
+static int line_tree_init(LineTree *tree, int leaf_count) {
+    tree->leaf_count = 1;
+    while (tree->leaf_count < leaf_count) {
+        tree->leaf_count *= 2;
+    }
+    tree->nodes = malloc(sizeof(Line) * 2 * (size_t)tree->leaf_count);
+    if (tree->nodes == NULL) {
+        return 1;
+    }
+    for (int node = 0; node < 2 * tree->leaf_count; node++) {
+        tree->nodes[node] = EMPTY_LINE;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets the leaf line and updates the first lines on the path to the root.
+ */
+static void line_tree_set(LineTree *tree, int leaf, Line line) {
+    int node = tree->leaf_count + leaf;
+    tree->nodes[node] = line;
+    for (node /= 2; node >= 1; node /= 2) {
+        Line *left = &tree->nodes[2 * node];
+        Line *right = &tree->nodes[2 * node + 1];
+        tree->nodes[node] = line_precedes(right, left) ? *right : *left;
+    }
+}
+
+/**
+ * @brief Keeps the first longest line of the row or col.
+ */
+static int keep_first_line(void *context, Line line) {
+    Line *longest = context;
+    if (line_precedes(&line, longest)) {
+        *longest = line;
+    }
+    return 0;
+}
+
+/**
+ * @brief Recomputes longest horizontal line and the first 1 pixel of the row.
+ */
+static void incremental_update_row(IncrementalSearch *search, int row) {
+    const Image *image = &search->image;
+    Line longest = EMPTY_LINE;
+    scan_row_runs(bitmap_row(image, row), image->stride, image->width, row, keep_first_line, &longest);
+    line_tree_set(&search->horizontal, row, longest);
+    Line first_pixel = EMPTY_LINE;
+    if (longest.length > 0) { // Row has 1 pixel
+        const BitmapWord *words = bitmap_row(image, row);
+        size_t word_idx = scan_kernels()->find_word_not(words, image->stride, 0);
+        first_pixel = make_line(row, (int)word_idx * BITMAP_WORD_BITS + __builtin_ctzll(words[word_idx]), 1, HORIZONTAL_LINE);
+    }
+    line_tree_set(&search->first_pixel, row, first_pixel);
+}
+
+/**
+ * @brief Recomputes longest vertical line of the col from the down-run table.
+ */
+static void incremental_update_col(IncrementalSearch *search, int col) {
+    const Image *image = &search->image;
+    size_t cols = (size_t)image->width;
+    Line longest = EMPTY_LINE;
+    for (int row = 0; row < image->height;) {
+        int length = search->down_run[(size_t)row * cols + (size_t)col];
+        if (length == 0) {
+            row++;
+            continue;
+        }
+        keep_first_line(&longest, make_line(row, col, length, VERTICAL_LINE));
+        row += length; // Skipping to the end of the line
+    }
+    line_tree_set(&search->vertical, col, longest);
+}
+
+/**
+ * @brief Checks the square by the run tables.
+ *
+ * @return 1 if all 4 borders of the square are made of 1 pixels, 0 otherwise.
+ */
+static inline int incremental_square_fits(const IncrementalSearch *search, int row, int col, int size) {
+    size_t cols = (size_t)search->image.width;
+    size_t corner = (size_t)row * cols + (size_t)col;
+    return search->right_run[corner] >= size && search->down_run[corner] >= size && // Top and left borders
+        search->down_run[corner + (size_t)size - 1] >= size && search->right_run[corner + (size_t)(size - 1) * cols] >= size;
+}
+
+/**
+ * @brief Keeps the square as the biggest square of its row if it goes before the kept one.
+ *
+ * Square of size n with the corner at (row, col) is stored as line of length n, so the
+ * line order is the square order: bigger first, then the top-left one.
+ */
+static void incremental_keep_square(IncrementalSearch *search, int row, int col, int size) {
+    Line line = make_line(row, col, size, HORIZONTAL_LINE);
+    if (line_precedes(&line, &search->squares.nodes[search->squares.leaf_count + row])) {
+        line_tree_set(&search->squares, row, line);
+    }
+}
+
+/**
+ * @brief Keeps the biggest square with the corner at the pixel, sizes smaller than min_size are not tried.
+ */
+static void incremental_check_corner(IncrementalSearch *search, int row, int col, int min_size) {
+    size_t corner = (size_t)row * (size_t)search->image.width + (size_t)col;
+    int size = search->right_run[corner] < search->down_run[corner] ? search->right_run[corner] : search->down_run[corner];
+    for (min_size = min_size < 1 ? 1 : min_size; size >= min_size; size--) {
+        if (incremental_square_fits(search, row, col, size)) {
+            incremental_keep_square(search, row, col, size);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Recomputes biggest square with the top-left corner on the row.
+ */
+static void incremental_update_square_row(IncrementalSearch *search, int row) {
+    line_tree_set(&search->squares, row, EMPTY_LINE);
+    for (int col = search->image.width - 1; col >= 0; col--) { // From the right, so the same size squares go left
+        incremental_check_corner(search, row, col, search->squares.nodes[search->squares.leaf_count + row].length);
+    }
+}
+
+/**
+ * @brief Recomputes down-runs of the col in the changed rows and above them, while they change.
+ */
+static void incremental_update_down_run(IncrementalSearch *search, int col, int row_begin, int row_end) {
+    const Image *image = &search->image;
+    size_t cols = (size_t)image->width;
+    for (int row = row_end - 1; row >= 0; row--) {
+        int below = row + 1 < image->height ? search->down_run[(size_t)(row + 1) * cols + (size_t)col] : 0;
+        int run = get_pixel(image, row, col) ? below + 1 : 0;
+        int *cell = &search->down_run[(size_t)row * cols + (size_t)col];
+        if (row < row_begin && *cell == run) { // Rows above are not changed
+            break;
+        }
+        *cell = run;
+    }
+}
+
+/**
+ * @brief Recomputes right-runs of the row in the changed cols and left of them, while they change.
+ */
+static void incremental_update_right_run(IncrementalSearch *search, int row, int col_begin, int col_end) {
+    const Image *image = &search->image;
+    int *runs = search->right_run + (size_t)row * (size_t)image->width;
+    for (int col = col_end - 1; col >= 0; col--) {
+        int run = get_pixel(image, row, col) ? (col + 1 < image->width ? runs[col + 1] : 0) + 1 : 0;
+        if (col < col_begin && runs[col] == run) { // Cols on the left are not changed
+            break;
+        }
+        runs[col] = run;
+    }
+}
+
+/**
+ * @brief Initializes incremental search on the copy of the image.
+ *
+ * Down-run and right-run tables(count of 1 pixels from each pixel downwards and to the right)
+ * and the longest lines of each row and col and the biggest square of each row are computed,
+ * their first ones are kept in trees. After a change only the rows, cols and square corners
+ * which can be affected are recomputed.
+ *
+ * @param[out] search Pointer to search.
+ * @param[in] image Pointer to image where bitmap stored is.
+ * @return 0 if initialization was successful(everything went well).
+ * @return -1 if image is empty or allocation failed.
+ */
+int incremental_search_init(IncrementalSearch *search, const Image *image) {
+    *search = (IncrementalSearch){.image = EMPTY_IMAGE};
+    if (image->height <= 0 || image->width <= 0 || image->bitmap == NULL) {
+        return -1;
+    }
+    size_t cols = (size_t)image->width;
+    search->image.width = image->width;
+    search->image.height = image->height;
+    if ((size_t)image->height > SIZE_MAX / sizeof(int) / cols || allocate_bitmap(&search->image)) {
+        return -1;
+    }
+    memcpy(search->image.bitmap, image->bitmap, sizeof(BitmapWord) * image->stride * (size_t)image->height);
+    search->down_run = malloc(sizeof(int) * cols * (size_t)image->height);
+    search->right_run = malloc(sizeof(int) * cols * (size_t)image->height);
+    if (search->down_run == NULL || search->right_run == NULL || line_tree_init(&search->horizontal, image->height) ||
+        line_tree_init(&search->vertical, image->width) || line_tree_init(&search->first_pixel, image->height) ||
+        line_tree_init(&search->squares, image->height)) {
+        incremental_search_free(search);
+        return -1;
+    }
+
+    for (int row = image->height - 1; row >= 0; row--) { // From the bottom, so the row below is known
+        for (int col = 0; col < image->width; col++) {
+            int below = row + 1 < image->height ? search->down_run[(size_t)(row + 1) * cols + (size_t)col] : 0;
+            search->down_run[(size_t)row * cols + (size_t)col] = get_pixel(image, row, col) ? below + 1 : 0;
+        }
+        incremental_update_right_run(search, row, 0, image->width);
+        incremental_update_row(search, row);
+        incremental_update_square_row(search, row);
+    }
+    for (int col = 0; col < image->width; col++) {
+        incremental_update_col(search, col);
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees incremental search.
+ *
+ * @param[in] search Pointer to search.
+ */
+void incremental_search_free(IncrementalSearch *search) {
+    if (search->image.bitmap != NULL) {
+        free_bitmap(&search->image);
+    }
+    free(search->down_run);
+    free(search->right_run);
+    free(search->horizontal.nodes);
+    free(search->vertical.nodes);
+    free(search->first_pixel.nodes);
+    free(search->squares.nodes);
+    *search = (IncrementalSearch){.image = EMPTY_IMAGE};
+}
+
+/**
+ * @brief Checks if the square border goes through the rectangle.
+ */
+static int square_border_crosses(const Line *corner, int row, int col, int row_end, int col_end) {
+    int top = corner->start.x_coordinate, left = corner->start.y_coordinate;
+    int bottom = top + corner->length - 1, right = left + corner->length - 1;
+    if (corner->length == 0 || row > bottom || row_end <= top || col > right || col_end <= left) { // Outside of the square
+        return 0;
+    }
+    return row <= top || row_end > bottom || col <= left || col_end > right; // Not inside of the square interior
+}
+
+/**
+ * @brief Writes the patch image to the image at the position and updates the search.
+ *
+ * Rows of the patch are recomputed. A square with the corner above the patch and a border
+ * in the patch crosses the patch top by its left or right border, or it has the bottom
+ * border in a patch row and the corner left of the patch. So the biggest square of the row
+ * above the patch changes only if the kept one has a border in the patch(the row is
+ * recomputed) or if one of these squares is bigger. They are found by walks from the patch
+ * top up each patch col while it has 1 pixels(left and right borders), and up from each
+ * patch row while the bottom border size can beat the kept square of the row.
+ *
+ * @param[in,out] search Pointer to search.
+ * @param[in] row Row of the patch top-left corner.
+ * @param[in] col Col of the patch top-left corner.
+ * @param[in] patch Pointer to patch image, it must be inside the image.
+ * @return 0 if patch was applied.
+ * @return 1 if patch is out of the image.
+ */
+int incremental_apply_patch(IncrementalSearch *search, int row, int col, const Image *patch) {
+    Image *image = &search->image;
+    if (row < 0 || col < 0 || patch->height <= 0 || patch->width <= 0 || patch->height > image->height - row ||
+        patch->width > image->width - col) {
+        return 1;
+    }
+    int row_end = row + patch->height;
+    int col_end = col + patch->width;
+    size_t cols = (size_t)image->width;
+    const Line *kept = search->squares.nodes + search->squares.leaf_count; // Biggest square of each row
+    int biggest_size = search->squares.nodes[1].length;
+
+    for (int patch_row = 0; patch_row < patch->height; patch_row++) {
+        for (int patch_col = 0; patch_col < patch->width; patch_col++) {
+            set_pixel(image, row + patch_row, col + patch_col, get_pixel(patch, patch_row, patch_col));
+        }
+    }
+
+    for (int patch_col = col; patch_col < col_end; patch_col++) {
+        incremental_update_down_run(search, patch_col, row, row_end);
+        incremental_update_col(search, patch_col);
+    }
+    for (int patch_row = row; patch_row < row_end; patch_row++) {
+        incremental_update_right_run(search, patch_row, col, col_end);
+        incremental_update_row(search, patch_row);
+    }
+    for (int patch_row = row; patch_row < row_end; patch_row++) { // Runs of all patch rows are needed
+        incremental_update_square_row(search, patch_row);
+    }
+    int first_row = row - biggest_size + 1 > 0 ? row - biggest_size + 1 : 0; // Kept squares above can not reach the patch
+    for (int square_row = first_row; square_row < row; square_row++) { // Kept squares with a border in the patch
+        if (square_border_crosses(&kept[square_row], row, col, row_end, col_end)) {
+            incremental_update_square_row(search, square_row);
+        }
+    }
+
+    for (int patch_col = col; patch_col < col_end; patch_col++) { // Left or right border crosses the patch top
+        for (int corner_row = row - 1; corner_row >= 0 && get_pixel(image, corner_row, patch_col); corner_row--) {
+            int min_size = row - corner_row + 1 > kept[corner_row].length ? row - corner_row + 1 : kept[corner_row].length;
+            incremental_check_corner(search, corner_row, patch_col, min_size); // Left border
+            for (int corner_col = patch_col - min_size + 1; corner_col >= 0 && get_pixel(image, corner_row, corner_col); corner_col--) {
+                if (incremental_square_fits(search, corner_row, corner_col, patch_col - corner_col + 1)) { // Right border
+                    incremental_keep_square(search, corner_row, corner_col, patch_col - corner_col + 1);
+                }
+            }
+        }
+    }
+    for (int bottom = row; bottom < row_end; bottom++) { // Bottom border crosses the patch left col
+        if (col == 0 || !get_pixel(image, bottom, col)) {
+            continue;
+        }
+        const int *bottom_runs = search->right_run + (size_t)bottom * cols;
+        for (int corner_row = row - 1; corner_row >= 0 && bottom - corner_row < image->width; corner_row--) {
+            int size = bottom - corner_row + 1;
+            if (size < kept[corner_row].length) {
+                continue;
+            }
+            for (int corner_col = col - 1; corner_col >= 0 && corner_col > col - size && bottom_runs[corner_col] > col - corner_col;
+                 corner_col--) {
+                if (incremental_square_fits(search, corner_row, corner_col, size)) {
+                    incremental_keep_square(search, corner_row, corner_col, size);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets one pixel of the image and updates the search.
+ *
+ * @param[in,out] search Pointer to search.
+ * @param[in] row Row index.
+ * @param[in] col Col index.
+ * @param[in] value New pixel value(0 or 1).
+ * @return 0 if pixel was set.
+ * @return 1 if pixel is out of the image.
+ */
+int incremental_set_pixel(IncrementalSearch *search, int row, int col, int value) {
+    BitmapWord word = value ? 1 : 0;
+    Image pixel = {1, 1, 1, &word, 0};
+    return incremental_apply_patch(search, row, col, &pixel);
+}
+
+/**
+ * @brief Returns the current longest lines and biggest square.
+ *
+ * Results are the same as the search_longest_line and search_biggest_square results.
+ *
+ * @param[in] search Pointer to search.
+ * @param[out] horizontal Pointer to the longest horizontal line.
+ * @param[out] vertical Pointer to the longest vertical line.
+ * @param[out] square Pointer to the biggest square.
+ * @return perimeter of the biggest square, 0 if there is no square.
+ */
+int incremental_search_result(const IncrementalSearch *search, Line *horizontal, Line *vertical, Square *square) {
+    *horizontal = search->horizontal.nodes[1];
+    *vertical = search->vertical.nodes[1];
+    if (vertical->length == 1) { // 1 pixel long vertical lines are taken in row order
+        *vertical = search->first_pixel.nodes[1];
+        vertical->line_type = VERTICAL_LINE;
+    }
+    Line corner = search->squares.nodes[1];
+    *square = (Square){{corner.start.x_coordinate, corner.start.y_coordinate},
+        {corner.start.x_coordinate + corner.length - 1, corner.start.y_coordinate + corner.length - 1}};
+    if (corner.length == 0) {
+        *square = EMPTY_SQUARE;
+    }
+    return corner.length * 4;
+}
+
+/**
+ * @brief Structure, describes header of the run-length index sidecar file.
+ *
+ * Index file(image file name + INDEX_SUFFIX) is the header followed by:
+ * rows + 1 row offsets(uint64_t) to the horizontal runs, horizontal runs(uint32_t col, length),
+ * cols + 1 col offsets(uint64_t) to the vertical runs, vertical runs(uint32_t row, length).
+ * Numbers are little-endian, as in the binary bitmap. Index is valid only while the source
+ * size, modification time and hash of the whole source file are the same.
+ * Lines are stored as row, col, length, square as row, col, size(0 if there is no square).
+ */
+typedef struct {
+    char magic[8];
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_hash;
+    uint32_t rows;
+    uint32_t cols;
+    int32_t hline[3];
+    int32_t vline[3];
+    int32_t square[3];
+    uint32_t reserved;
+    uint64_t horizontal_run_count;
+    uint64_t vertical_run_count;
+} IndexHeader;
+
+/**
+ * @brief Converts numbers of the index header to little-endian and back.
+ */
+static void index_header_order(IndexHeader *header) {
+    header->source_size = little_endian64(header->source_size);
+    header->source_mtime_sec = (int64_t)little_endian64((uint64_t)header->source_mtime_sec);
+    header->source_mtime_nsec = (int64_t)little_endian64((uint64_t)header->source_mtime_nsec);
+    header->source_hash = little_endian64(header->source_hash);
+    header->rows = little_endian32(header->rows);
+    header->cols = little_endian32(header->cols);
+    for (int idx = 0; idx < 3; idx++) {
+        header->hline[idx] = (int32_t)little_endian32((uint32_t)header->hline[idx]);
+        header->vline[idx] = (int32_t)little_endian32((uint32_t)header->vline[idx]);
+        header->square[idx] = (int32_t)little_endian32((uint32_t)header->square[idx]);
+    }
+    header->horizontal_run_count = little_endian64(header->horizontal_run_count);
+    header->vertical_run_count = little_endian64(header->vertical_run_count);
+}
+
+/**
+ * @brief Fills the source key(size, modification time and hash) of the index header.
+ *
+ * Hash is FNV-1a over the little-endian 64-bit words of the whole file, so any change
+ * of the content is found even if the size and modification time were kept.
+ *
+ * @param[in] filename Name of the image file.
+ * @param[out] header Pointer to index header.
+ * @param[in,out] bytes_read Count of the read bytes is added to it, or NULL.
+ * @return 0 if key was computed.
+ * @return 1 if file is not regular file or can not be read.
+ */
+static int index_source_key(const char *filename, IndexHeader *header, uint64_t *bytes_read) {
+    if (strcmp(filename, "-") == 0) { // Standard input has no index
+        return 1;
+    }
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor == -1) {
+        return 1;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) == -1 || !S_ISREG(info.st_mode)) {
+        close(descriptor);
+        return 1;
+    }
+    header->source_size = (uint64_t)info.st_size;
+    header->source_mtime_sec = (int64_t)info.st_mtim.tv_sec;
+    header->source_mtime_nsec = (int64_t)info.st_mtim.tv_nsec;
+
+    unsigned char *block = malloc(READER_BUFFER_SIZE);
+    uint64_t hash = CHECKSUM_SEED;
+    uint64_t hashed = 0;
+    int status = block == NULL;
+    size_t size = READER_BUFFER_SIZE;
+    while (!status && size == READER_BUFFER_SIZE) { // Till the block is not full
+        size = 0;
+        while (size < READER_BUFFER_SIZE) { // Full blocks, so the words do not depend on the read sizes
+            ssize_t length = read(descriptor, block + size, READER_BUFFER_SIZE - size);
+            if (length == -1 && errno == EINTR) {
+                continue;
+            }
+            if (length <= 0) {
+                status = length == -1;
+                break;
+            }
+            size += (size_t)length;
+        }
+        hashed += size;
+        size_t byte = 0;
+        for (; byte + sizeof(uint64_t) <= size; byte += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, block + byte, sizeof(word));
+            hash = (hash ^ little_endian64(word)) * CHECKSUM_PRIME;
+        }
+        for (; byte < size; byte++) { // Tail of the file
+            hash = (hash ^ block[byte]) * CHECKSUM_PRIME;
+        }
+    }
+    close(descriptor);
+    header->source_hash = hash;
+    if (bytes_read != NULL) {
+        *bytes_read += hashed;
+    }
+    free(block);
+    return status;
+}
+
+/**
+ * @brief Returns index file name for the image file, must be freed.
+ */
+static char *index_filename(const char *filename) {
+    char *name = malloc(strlen(filename) + sizeof(INDEX_SUFFIX));
+    if (name != NULL) {
+        strcpy(name, filename);
+        strcat(name, INDEX_SUFFIX);
+    }
+    return name;
+}
+
+/**
+ * @brief Structure, describes run list collected for the index.
+ */
+typedef struct {
+    uint64_t *offsets;
+    uint32_t *runs;
+    uint64_t count;
+    int counting;
+} IndexRuns;
+
+/**
+ * @brief Collects line to the index runs. First pass counts lines per row or col, second stores them.
+ */
+static int collect_index_run(void *context, Line line) {
+    IndexRuns *runs = context;
+    int owner = line.line_type == HORIZONTAL_LINE ? line.start.x_coordinate : line.start.y_coordinate;
+    if (runs->counting) {
+        runs->offsets[owner + 1]++;
+        runs->count++;
+        return 0;
+    }
+    uint64_t position = runs->offsets[owner]++; // Offsets are moved by one line during the second pass
+    runs->runs[2 * position] = (uint32_t)(line.line_type == HORIZONTAL_LINE ? line.start.y_coordinate : line.start.x_coordinate);
+    runs->runs[2 * position + 1] = (uint32_t)line.length;
+    return 0;
+}
+
+/**
+ * @brief Collects all runs of the type, grouped by rows(horizontal) or cols(vertical).
+ *
+ * @return 0 if runs were collected, 1 if allocation failed.
+ */
+static int collect_index_runs(const Image *image, int line_type, IndexRuns *runs) {
+    size_t owners = (size_t)(line_type == HORIZONTAL_LINE ? image->height : image->width);
+    runs->offsets = calloc(owners + 1, sizeof(uint64_t));
+    runs->runs = NULL;
+    runs->count = 0;
+    if (runs->offsets == NULL) {
+        return 1;
+    }
+    runs->counting = 1;
+    scan_rows_lines(image, line_type, 0, image->height, collect_index_run, runs);
+    for (size_t owner = 0; owner < owners; owner++) { // Counts to offsets of the following owner
+        runs->offsets[owner + 1] += runs->offsets[owner];
+    }
+    runs->runs = malloc(sizeof(uint32_t) * 2 * (runs->count ? runs->count : 1));
+    if (runs->runs == NULL) {
+        return 1;
+    }
+    runs->counting = 0;
+    scan_rows_lines(image, line_type, 0, image->height, collect_index_run, runs);
+    memmove(runs->offsets + 1, runs->offsets, sizeof(uint64_t) * owners); // Moving offsets back
+    runs->offsets[0] = 0;
+    return 0;
+}
+
+/**
+ * @brief Converts offsets and runs of the owners(rows or cols) to little-endian.
+ */
+static void index_runs_order(IndexRuns *runs, int owners) {
+    for (size_t owner = 0; owner <= (size_t)owners; owner++) {
+        runs->offsets[owner] = little_endian64(runs->offsets[owner]);
+    }
+    for (uint64_t run = 0; run < 2 * runs->count; run++) {
+        runs->runs[run] = little_endian32(runs->runs[run]);
+    }
+}
+
+/**
+ * @brief Builds run-length index sidecar for the image file.
+ *
+ * @param[in] filename Name of the image file.
+ * @return 0 if index was written(everything went well).
+ * @return 1 if file is not correct or index can not be written.
+ */
+int build_index(const char *filename) {
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    if (index_source_key(filename, &header, NULL)) {
+        return 1;
+    }
+    Image image = EMPTY_IMAGE;
+    if (parse_image(&image, filename)) {
+        return 1;
+    }
+
+    Line horizontal;
+    Line vertical;
+    Square square;
+    int perimeter = search_all_figures(NULL, &image, &horizontal, &vertical, &square);
+    IndexRuns horizontal_runs = {NULL, NULL, 0, 0};
+    IndexRuns vertical_runs = {NULL, NULL, 0, 0};
+    int status = perimeter == -1 || collect_index_runs(&image, HORIZONTAL_LINE, &horizontal_runs) ||
+        collect_index_runs(&image, VERTICAL_LINE, &vertical_runs);
+
+    char *name = index_filename(filename);
+    FILE *file = status == 0 && name != NULL ? fopen(name, "wb") : NULL;
+    if (file != NULL) {
+        header.rows = (uint32_t)image.height;
+        header.cols = (uint32_t)image.width;
+        int32_t lines[2][3] = {{horizontal.start.x_coordinate, horizontal.start.y_coordinate, horizontal.length},
+            {vertical.start.x_coordinate, vertical.start.y_coordinate, vertical.length}};
+        memcpy(header.hline, lines[0], sizeof(header.hline));
+        memcpy(header.vline, lines[1], sizeof(header.vline));
+        header.square[0] = square.start_point.x_coordinate;
+        header.square[1] = square.start_point.y_coordinate;
+        header.square[2] = perimeter / 4;
+        header.horizontal_run_count = horizontal_runs.count;
+        header.vertical_run_count = vertical_runs.count;
+        index_header_order(&header);
+        index_runs_order(&horizontal_runs, image.height);
+        index_runs_order(&vertical_runs, image.width);
+        status = fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(horizontal_runs.offsets, sizeof(uint64_t), (size_t)image.height + 1, file) != (size_t)image.height + 1 ||
+            fwrite(horizontal_runs.runs, sizeof(uint32_t) * 2, horizontal_runs.count, file) != horizontal_runs.count ||
+            fwrite(vertical_runs.offsets, sizeof(uint64_t), (size_t)image.width + 1, file) != (size_t)image.width + 1 ||
+            fwrite(vertical_runs.runs, sizeof(uint32_t) * 2, vertical_runs.count, file) != vertical_runs.count;
+        if (fclose(file) != 0) {
+            status = 1;
+        }
+    }
+    else {
+        status = 1;
+    }
+    free(name);
+    free(horizontal_runs.offsets);
+    free(horizontal_runs.runs);
+    free(vertical_runs.offsets);
+    free(vertical_runs.runs);
+    free_bitmap(&image);
+    return status;
+}
+
+/**
+ * @brief Maps the run-length index sidecar of the image file if it is up to date.
+ *
+ * Source file is hashed only if there is a sidecar with the index magic.
+ *
+ * @param[in] filename Name of the image file.
+ * @param[out] reader Pointer to reader with the mapped index, unmap it by reader_close.
+ * @param[out] header Pointer to index header in the host byte order.
+ * @param[in,out] bytes_read Count of the read bytes(index header and source) is added to it.
+ * @return 0 if index is mapped and valid.
+ * @return 1 if there is no valid index.
+ */
+static int index_open(const char *filename, Reader *reader, IndexHeader *header, uint64_t *bytes_read) {
+    char *name = strcmp(filename, "-") != 0 ? index_filename(filename) : NULL; // Standard input has no index
+    if (name == NULL || reader_map(reader, name)) {
+        free(name);
+        return 1;
+    }
+    free(name);
+
+    IndexHeader key;
+    if (reader->size >= sizeof(IndexHeader)) {
+        memcpy(header, reader->data, sizeof(IndexHeader));
+        index_header_order(header);
+        *bytes_read += sizeof(IndexHeader);
+    }
+    if (reader->size >= sizeof(IndexHeader) && memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+        index_source_key(filename, &key, bytes_read) == 0 && header->source_size == key.source_size && header->source_mtime_sec == key.source_mtime_sec &&
+        header->source_mtime_nsec == key.source_mtime_nsec && header->source_hash == key.source_hash) { // Index is up to date
+        return 0;
+    }
+    reader_close(reader);
+    return 1;
+}
+
+/**
+ * @brief Loads figures from the run-length index sidecar, if it is valid for the image file.
+ *
+ * Index is mapped to memory, only its header is read.
+ *
+ * @param[in] filename Name of the image file.
+ * @param[out] horizontal Pointer to the longest horizontal line.
+ * @param[out] vertical Pointer to the longest vertical line.
+ * @param[out] square Pointer to the biggest square.
+ * @param[out] bytes_read Count of the read bytes(index header and the hashed source, also if
+ * index is not valid), or NULL.
+ * @return perimeter of the biggest square, 0 if there is no square.
+ * @return -1 if there is no valid index.
+ */
+int load_index(const char *filename, Line *horizontal, Line *vertical, Square *square, uint64_t *bytes_read) {
+    Reader reader;
+    IndexHeader header;
+    uint64_t read = 0;
+    int status = index_open(filename, &reader, &header, &read);
+    if (bytes_read != NULL) {
+        *bytes_read = read;
+    }
+    if (status) {
+        return -1;
+    }
+    *horizontal = make_line(header.hline[0], header.hline[1], header.hline[2], HORIZONTAL_LINE);
+    *vertical = make_line(header.vline[0], header.vline[1], header.vline[2], VERTICAL_LINE);
+    int size = header.square[2];
+    *square = (Square){{header.square[0], header.square[1]}, {header.square[0] + size - 1, header.square[1] + size - 1}};
+    reader_close(&reader);
+    return size * 4;
+}
+
+/**
+ * @brief Clips region to the image.
+ *
+ * @return 0 if region is not empty.
+ * @return 1 if region is empty or its start is outside of the image.
+ */
+static int clip_region(Region *region, int rows, int cols) {
+    Point *start = &region->start_point;
+    Point *end = &region->end_point;
+    if (start->x_coordinate < 0 || start->y_coordinate < 0 || start->x_coordinate >= rows || start->y_coordinate >= cols ||
+        end->x_coordinate < start->x_coordinate || end->y_coordinate < start->y_coordinate) {
+        return 1;
+    }
+    if (end->x_coordinate >= rows) {
+        end->x_coordinate = rows - 1;
+    }
+    if (end->y_coordinate >= cols) {
+        end->y_coordinate = cols - 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Clips region and allocates image of its size.
+ *
+ * @return 0 if image is ready, 1 if region is empty or allocation failed.
+ */
+static int begin_region(Image *dst, Region *region, int rows, int cols) {
+    if (clip_region(region, rows, cols)) {
+        return 1;
+    }
+    dst->height = region->end_point.x_coordinate - region->start_point.x_coordinate + 1;
+    dst->width = region->end_point.y_coordinate - region->start_point.y_coordinate + 1;
+    return allocate_bitmap(dst);
+}
+
+/**
+ * @brief Sets length bits of the row from the col.
+ */
+static void set_row_range(BitmapWord *words, int col, int length) {
+    while (length > 0) {
+        int bit = col % BITMAP_WORD_BITS;
+        int count = BITMAP_WORD_BITS - bit < length ? BITMAP_WORD_BITS - bit : length;
+        words[col / BITMAP_WORD_BITS] |= (count == BITMAP_WORD_BITS) ? ~(BitmapWord)0 : (((BitmapWord)1 << count) - 1) << bit;
+        col += count;
+        length -= count;
+    }
+}
+
+/**
+ * @brief Reads region from the horizontal runs of the mapped index.
+ *
+ * Runs of the region rows are found by the row offsets, the first run of each row
+ * reaching the region by binary search. Row offsets and runs read are added to bytes_read.
+ *
+ * @return 0 if region was read, 1 if index is damaged or allocation failed.
+ */
+static int parse_index_region(const Reader *reader, const IndexHeader *header, Image *dst, Region *region, uint64_t *bytes_read) {
+    uint64_t run_count = header->horizontal_run_count;
+    if (header->rows > INT_MAX || header->cols > INT_MAX || run_count > reader->size ||
+        reader->size < sizeof(IndexHeader) + sizeof(uint64_t) * ((uint64_t)header->rows + 1) + sizeof(uint32_t) * 2 * run_count ||
+        begin_region(dst, region, (int)header->rows, (int)header->cols)) {
+        return 1;
+    }
+    const uint64_t *offsets = (const uint64_t *)(reader->data + sizeof(IndexHeader));
+    const uint32_t *runs = (const uint32_t *)(offsets + header->rows + 1);
+    uint64_t col_begin = (uint64_t)region->start_point.y_coordinate;
+    uint64_t col_end = (uint64_t)region->end_point.y_coordinate;
+    uint64_t runs_read = 0;
+    *bytes_read += sizeof(uint64_t) * (uint64_t)(dst->height + 1); // Row offsets
+    for (int row = region->start_point.x_coordinate; row <= region->end_point.x_coordinate; row++) {
+        uint64_t low = little_endian64(offsets[row]);
+        uint64_t high = little_endian64(offsets[row + 1]);
+        if (low > high || high > run_count) {
+            return 1;
+        }
+        uint64_t last = high;
+        while (low < high) { // First run ending in the region or after it
+            uint64_t middle = low + (high - low) / 2;
+            runs_read++;
+            if ((uint64_t)little_endian32(runs[2 * middle]) + little_endian32(runs[2 * middle + 1]) <= col_begin) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        BitmapWord *words = bitmap_row(dst, row - region->start_point.x_coordinate);
+        for (uint64_t run = low; run < last && little_endian32(runs[2 * run]) <= col_end; run++) {
+            uint64_t run_col = little_endian32(runs[2 * run]);
+            uint64_t begin = run_col > col_begin ? run_col : col_begin;
+            uint64_t end = run_col + little_endian32(runs[2 * run + 1]) - 1;
+            if (end > col_end) {
+                end = col_end;
+            }
+            set_row_range(words, (int)(begin - col_begin), (int)(end - begin + 1));
+            runs_read++;
+        }
+    }
+    *bytes_read += sizeof(uint32_t) * 2 * runs_read;
+    return 0;
+}
+
+/**
+ * @brief Returns high bit of each byte of the chunk which is equal to the byte value.
+ */
+static inline uint64_t chunk_bytes_equal(uint64_t chunk, unsigned char value) {
+    const uint64_t low_bits = 0x7f7f7f7f7f7f7f7full;
+    uint64_t zeros = chunk ^ (0x0101010101010101ull * value); // Equal bytes are 0
+    return ~(((zeros & low_bits) + low_bits) | zeros) & ~low_bits;
+}
+
+/**
+ * @brief Skips count pixel values, they are checked as reader_read_pixel does.
+ *
+ * Input is scanned by 8 bytes while they hold only '0' and '1' single character values and
+ * separators, other bytes(number prefixes, invalid values) go through reader_read_pixel.
+ *
+ * @param[in] reader Pointer to reader, stays at the start of a value or separator.
+ * @param[in] count Count of values to skip.
+ * @return 0 if values were skipped, reader stays after the last of them.
+ * @return 1 if a value is invalid or input ends before.
+ */
+static int reader_skip_pixels(Reader *reader, uint64_t count) {
+    const uint64_t last_byte = 0x80ull << 56;
+    while (count > 0) {
+        if (reader->size - reader->position >= sizeof(uint64_t)) {
+            uint64_t chunk;
+            memcpy(&chunk, reader->data + reader->position, sizeof(chunk));
+            uint64_t digits = chunk_bytes_equal(chunk & 0xfefefefefefefefeull, '0'); // '0' and '1'
+            uint64_t separators =
+                chunk_bytes_equal(chunk, ' ') | chunk_bytes_equal(chunk, '\n') | chunk_bytes_equal(chunk, '\t') | chunk_bytes_equal(chunk, '\r');
+            if ((digits | separators) == 0x8080808080808080ull && (digits & (digits << 8)) == 0) { // Single character values
+                size_t length = (digits & last_byte) ? sizeof(chunk) - 1 : sizeof(chunk); // Last value can go on
+                int found = __builtin_popcountll(digits & ~last_byte);
+                if ((uint64_t)found <= count) {
+                    count -= (uint64_t)found;
+                    reader->position += length;
+                    continue;
+                }
+            }
+        }
+        if (reader_read_pixel(reader) < 0) {
+            return 1;
+        }
+        count--;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads region from the binary bitmap, only the words of the region are read.
+ *
+ * Header, file size and padding bits of the read words are checked, checksum is not.
+ * Count of the read bytes is added to bytes_read.
+ *
+ * @return 0 if region was read, 1 if file is damaged or allocation failed.
+ */
+static int parse_binary_region(Reader *reader, Image *dst, Region *region, uint64_t *bytes_read) {
+    BinaryHeader header;
+    *bytes_read += sizeof(header);
+    if (reader_read_bytes(reader, &header, sizeof(header)) != sizeof(header)) {
+        return 1;
+    }
+    uint32_t rows = little_endian32(header.rows);
+    uint32_t cols = little_endian32(header.cols);
+    uint64_t stride = little_endian64(header.stride);
+    if (rows == 0 || cols == 0 || rows > INT_MAX || cols > INT_MAX || stride != ((uint64_t)cols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS) {
+        return 1;
+    }
+    if (begin_region(dst, region, (int)rows, (int)cols)) {
+        return 1;
+    }
+
+    size_t first_word = (size_t)region->start_point.y_coordinate / BITMAP_WORD_BITS;
+    size_t word_count = (size_t)region->end_point.y_coordinate / BITMAP_WORD_BITS - first_word + 1;
+    int shift = region->start_point.y_coordinate % BITMAP_WORD_BITS;
+    int tail = dst->width % BITMAP_WORD_BITS;
+    BitmapWord padding_mask = cols % BITMAP_WORD_BITS ? ~(BitmapWord)0 << (cols % BITMAP_WORD_BITS) : 0;
+    BitmapWord *words = malloc(sizeof(BitmapWord) * (word_count + 1));
+    int status = words == NULL;
+    for (int row = region->start_point.x_coordinate; row <= region->end_point.x_coordinate && status == 0; row++) {
+        uint64_t offset = BINARY_HEADER_SIZE + sizeof(BitmapWord) * ((uint64_t)row * stride + first_word);
+        *bytes_read += sizeof(BitmapWord) * word_count;
+        if (reader_seek(reader, offset) || reader_read_bytes(reader, words, sizeof(BitmapWord) * word_count) != sizeof(BitmapWord) * word_count) {
+            status = 1;
+            break;
+        }
+        for (size_t word_idx = 0; word_idx < word_count; word_idx++) {
+            words[word_idx] = little_endian64(words[word_idx]);
+        }
+        if (first_word + word_count == stride && (words[word_count - 1] & padding_mask)) { // Padding bits must be 0
+            status = 1;
+            break;
+        }
+        words[word_count] = 0;
+        BitmapWord *target = bitmap_row(dst, row - region->start_point.x_coordinate);
+        for (size_t word_idx = 0; word_idx < dst->stride; word_idx++) { // Moving the region start to bit 0
+            target[word_idx] = shift ? (words[word_idx] >> shift) | (words[word_idx + 1] << (BITMAP_WORD_BITS - shift)) : words[word_idx];
+        }
+        if (tail) {
+            target[dst->stride - 1] &= ((BitmapWord)1 << tail) - 1;
+        }
+    }
+    char last[2];
+    *bytes_read += status == 0;
+    if (status == 0 && (reader_seek(reader, BINARY_HEADER_SIZE + sizeof(BitmapWord) * stride * rows - 1) ||
+        reader_read_bytes(reader, last, 2) != 1)) { // File is shorter or longer than the bitmap
+        status = 1;
+    }
+    free(words);
+    return status;
+}
+
+/**
+ * @brief Reads region from the text bitmap.
+ *
+ * Values before the region and beside it are checked and skipped, reading stops after
+ * the last region row, so the rows below it are not checked. Values of the region are
+ * checked and packed.
+ *
+ * @return 0 if region was read, 1 if file is damaged or allocation failed.
+ */
+static int parse_text_region(Reader *reader, Image *dst, Region *region) {
+    int rows;
+    int cols;
+    if (reader_read_dimension(reader, &rows) || reader_read_dimension(reader, &cols) || rows <= 0 || cols <= 0 ||
+        begin_region(dst, region, rows, cols)) {
+        return 1;
+    }
+    int col_begin = region->start_point.y_coordinate;
+    uint64_t skipped = (uint64_t)region->start_point.x_coordinate * (uint64_t)cols + (uint64_t)col_begin; // Till the region start
+    for (int row = 0; row < dst->height; row++) {
+        if (reader_skip_pixels(reader, skipped)) {
+            return 1;
+        }
+        BitmapWord *words = bitmap_row(dst, row);
+        for (int col = 0; col < dst->width; col++) {
+            int value = reader_read_pixel(reader);
+            if (value < 0) {
+                return 1;
+            }
+            words[col / BITMAP_WORD_BITS] |= (BitmapWord)value << (col % BITMAP_WORD_BITS);
+        }
+        skipped = (uint64_t)cols - (uint64_t)dst->width; // Rest of the row and the start of the next one
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses rectangular region of the bitmap file to image structure.
+ *
+ * Valid run-length index is used if there is one, binary bitmap is read by seeking to the
+ * region rows, text bitmap is scanned only till the last region row. Region is clipped
+ * to the image, pixel(0, 0) of the image is the region start.
+ *
+ * @param[out] dst Pointer to image where will region bitmap stored be.
+ * @param[in] filename Name of the image file.
+ * @param[in,out] region Pointer to region, clipped to the image.
+ * @param[out] bytes_read Count of the bytes read from the index and the file, or NULL.
+ * @return 0 if parsing was successful(everything went well).
+ * @return 1 if file is not correct, region is empty or allocation failed.
+ */
+int parse_image_region(Image *dst, const char *filename, Region *region, uint64_t *bytes_read) {
+    Reader reader;
+    Region requested = *region;
+    IndexHeader header;
+    uint64_t read = 0;
+    uint64_t *total = bytes_read != NULL ? bytes_read : &read;
+    *total = 0;
+    if (index_open(filename, &reader, &header, total) == 0) {
+        int status = parse_index_region(&reader, &header, dst, region, total);
+        reader_close(&reader);
+        if (status == 0) {
+            return 0;
+        }
+        *region = requested; // Damaged index, reading the file
+    }
+    if (reader_open(&reader, filename)) {
+        return 1;
+    }
+    int status;
+    uint64_t mapped = 0; // Bytes of the mapped file used by the parser
+    if (reader_starts_with(&reader, BINARY_MAGIC, BINARY_MAGIC_SIZE)) {
+        status = parse_binary_region(&reader, dst, region, &mapped);
+    }
+    else {
+        status = parse_text_region(&reader, dst, region);
+        mapped = reader.offset + reader.position; // Text is scanned till the position
+    }
+    *total += reader_bytes_read(&reader, mapped);
+    reader_close(&reader);
+    if (status != 0) {
+        free_bitmap(dst);
+    }
+    return status;
+}